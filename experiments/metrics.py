@@ -0,0 +1,64 @@
+import argparse
+import os
+import struct
+import time
+
+# Mirrors Metrics in src/types.h
+FORMAT = "<IIQQQQQQQdddd"
+FIELDS = ["updated", "epoch", "batch", "queue_depth", "waited_ms", "rss", "loss", "speed", "alpha", "error"]
+MAGIC = int.from_bytes(b"BRKM", "little")
+
+
+def read_metrics(path):
+    """A consistent snapshot of a run's live metrics, retried while the trainer is mid update"""
+    size = struct.calcsize(FORMAT)
+
+    while True:
+        with open(path, "rb") as f:
+            data = f.read(size)
+
+        magic, version, before, *values = struct.unpack(FORMAT, data)
+        if magic != MAGIC:
+            raise ValueError(f"{path} is not a metrics file")
+
+        with open(path, "rb") as f:
+            f.seek(8)
+            after = struct.unpack("<Q", f.read(8))[0]
+
+        if before == after and not before & 1:
+            return dict(zip(FIELDS, values), version=version)
+
+        time.sleep(0.001)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Print the live metrics of a training run",
+        formatter_class=argparse.ArgumentDefaultsHelpFormatter,
+    )
+
+    parser.add_argument(
+        "root_dir",
+        type=str,
+        help="root directory with metrics",
+    )
+
+    parser.add_argument(
+        "--interval",
+        type=float,
+        default=0,
+        help="seconds between polls, 0 to print once",
+    )
+
+    args = parser.parse_args()
+    path = os.path.join(args.root_dir, "metrics")
+
+    while True:
+        print(read_metrics(path))
+        if args.interval <= 0:
+            break
+        time.sleep(args.interval)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,120 @@
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#define PAGE_4KB (4ULL << 10)
+#define PAGE_2MB (2ULL << 20)
+#define PAGE_1GB (1ULL << 30)
+
+#ifdef WIN32
+void ArenaInit(Arena* arena, size_t size) {
+  arena->size = ArenaBytes(size);
+  arena->used = 0;
+  arena->pageSize = PAGE_4KB;
+  arena->kind = "VirtualAlloc";
+
+  arena->base = VirtualAlloc(NULL, arena->size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  if (arena->base == NULL) printf("Unable to allocate a %zu byte arena!\n", arena->size), exit(1);
+}
+#else
+// Attempt a hugetlbfs mapping of the given page size, this will only
+// succeed when pages have been reserved (vm.nr_hugepages or hugepages= at boot)
+static char* MapHugeTLB(size_t size, size_t pageSize, int shift) {
+  size = (size + pageSize - 1) & ~(pageSize - 1);
+
+  void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE | (shift << MAP_HUGE_SHIFT), -1, 0);
+
+  return mem == MAP_FAILED ? NULL : mem;
+}
+
+void ArenaInit(Arena* arena, size_t size) {
+  arena->size = ArenaBytes(size);
+  arena->used = 0;
+
+  if (arena->size >= PAGE_1GB && (arena->base = MapHugeTLB(arena->size, PAGE_1GB, 30))) {
+    arena->pageSize = PAGE_1GB;
+    arena->kind = "hugetlbfs";
+    return;
+  }
+
+  if ((arena->base = MapHugeTLB(arena->size, PAGE_2MB, 21))) {
+    arena->pageSize = PAGE_2MB;
+    arena->kind = "hugetlbfs";
+    return;
+  }
+
+  // Fallback to transparent huge pages, over-allocate so the region can start on a 2MB boundary
+  char* mem = mmap(NULL, arena->size + PAGE_2MB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) printf("Unable to allocate a %zu byte arena!\n", arena->size), exit(1);
+
+  arena->base = (char*)(((uintptr_t)mem + PAGE_2MB - 1) & ~(PAGE_2MB - 1));
+  arena->pageSize = PAGE_4KB;
+  arena->kind = "anonymous";
+
+#ifdef MADV_HUGEPAGE
+  if (!madvise(arena->base, arena->size, MADV_HUGEPAGE)) arena->kind = "transparent huge pages";
+#endif
+
+  // fault everything in now, so placement happens once at startup
+  for (size_t i = 0; i < arena->size; i += PAGE_4KB) arena->base[i] = 0;
+}
+#endif
+
+void* ArenaAlloc(Arena* arena, size_t size) {
+  size = ArenaBytes(size);
+
+  if (arena->used + size > arena->size)
+    printf("Arena exhausted, unable to allocate %zu bytes (%zu of %zu used)!\n", size, arena->used, arena->size),
+        exit(1);
+
+  void* ptr = arena->base + arena->used;
+  arena->used += size;
+
+  return ptr;
+}
+
+void ArenaReport(Arena* arena) {
+  printf("Arena: [%zu MB], Backing: [%s]", arena->size >> 20, arena->kind);
+
+#ifndef WIN32
+  // The kernel's view of the mapping (KernelPageSize is 4kB for THP, check AnonHugePages)
+  FILE* fp = fopen("/proc/self/smaps", "r");
+  if (fp) {
+    char line[256];
+    uintptr_t start, end;
+    int found = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+      if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " ", &start, &end) == 2) {
+        found = start <= (uintptr_t)arena->base && (uintptr_t)arena->base < end;
+        continue;
+      }
+
+      if (!found) continue;
+
+      size_t kb;
+      if (sscanf(line, "KernelPageSize: %zu kB", &kb) == 1)
+        printf(", Page Size: [%zu kB]", kb);
+      else if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1)
+        printf(", Huge: [%zu of %zu MB]", kb >> 10, arena->size >> 20);
+    }
+
+    fclose(fp);
+  }
+#endif
+
+  printf("\n");
+}
@@ -0,0 +1,15 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "types.h"
+#include "util.h"
+
+#define ARENA_ALIGN 4096
+
+INLINE size_t ArenaBytes(size_t size) { return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1); }
+
+void ArenaInit(Arena* arena, size_t size);
+void* ArenaAlloc(Arena* arena, size_t size);
+void ArenaReport(Arena* arena);
+
+#endif
@@ -1,5 +1,6 @@
 #include "board.h"
 
+#include <immintrin.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,20 +8,171 @@
 
 #include "bits.h"
 
-void ToFeatures(Board* board, Features* f) {
-  f->n = 0;
+#if defined(__AVX512VBMI2__) && defined(__AVX512BW__)
+// Byte i is i, compressed down to the occupied squares in order
+static const uint8_t SQUARES[64] ALIGN64 = {
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21,
+    22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43,
+    44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63,
+};
+#endif
+
+// Each view's piece, Invert() for black, as a byte shuffle of the piece nibbles (one table per lane)
+static const uint8_t VIEW_PIECES[2][32] ALIGN64 = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 0, 0, 0},
+    {6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 0, 0, 0, 0, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 0, 0, 0, 0},
+};
+
+// idx() is piece * 128 + bucket * 64 + square, with the square flipped so the view's king sits on the
+// e-h files (and the board upside down for black). Only the flip and the bucket depend on the king.
+INLINE void KingTerms(Square king, const Color view, uint8_t* flip, uint16_t* bucket) {
+  *flip = (7 * !(king & 4)) ^ (56 * view);
+  *bucket = KING_BUCKETS[*flip ^ king] * 64;
+}
+
+// The pieces, unpacked from their nibbles in occupancy order
+INLINE __m256i UnpackPieces(Board* board) {
+  const __m128i packed = _mm_loadu_si128((__m128i*)board->pieces);
+  const __m128i lo = _mm_and_si128(packed, _mm_set1_epi8(0x0F));
+  const __m128i hi = _mm_and_si128(_mm_srli_epi16(packed, 4), _mm_set1_epi8(0x0F));
+
+  return _mm256_set_m128i(_mm_unpackhi_epi8(lo, hi), _mm_unpacklo_epi8(lo, hi));
+}
+
+// Writes all 32 (white, black) pairs of a position's features, only the first (returned) n of them
+// are its pieces. Branch free, with the squares and pieces unpacked and indexed a vector at a time.
+int WriteFeatures(Board* board, Feature features[32][2]) {
+  const __m256i pieces = UnpackPieces(board);
+
+#if defined(__AVX512VBMI2__) && defined(__AVX512BW__)
+  const __m256i squares =
+      _mm512_castsi512_si256(_mm512_maskz_compress_epi8(board->occupancies, _mm512_load_si512(SQUARES)));
+#else
+  uint8_t occupied[32] ALIGN64 = {0};
 
   uint64_t bb = board->occupancies;
+  for (int n = 0; bb; n++) occupied[n] = popLsb(&bb);
 
-  while (bb) {
-    Square sq = popLsb(&bb);
-    Piece pc = getPiece(board->pieces, f->n);
+  const __m256i squares = _mm256_load_si256((__m256i*)occupied);
+#endif
+
+  __m256i views[2][2];
+  for (Color view = WHITE; view <= BLACK; view++) {
+    uint8_t flip;
+    uint16_t bucket;
+    KingTerms(board->kings[view], view, &flip, &bucket);
+
+    const __m256i viewPieces = _mm256_shuffle_epi8(_mm256_load_si256((__m256i*)VIEW_PIECES[view]), pieces);
+    const __m256i viewSquares = _mm256_xor_si256(squares, _mm256_set1_epi8(flip));
 
-    f->features[f->n][WHITE] = idx(pc, sq, board->kings[WHITE], WHITE);
-    f->features[f->n][BLACK] = idx(pc, sq, board->kings[BLACK], BLACK);
+    for (int h = 0; h < 2; h++) {
+      const __m256i pc = _mm256_cvtepu8_epi16(h ? _mm256_extracti128_si256(viewPieces, 1)  //
+                                                : _mm256_castsi256_si128(viewPieces));
+      const __m256i sq = _mm256_cvtepu8_epi16(h ? _mm256_extracti128_si256(viewSquares, 1)  //
+                                                : _mm256_castsi256_si128(viewSquares));
 
-    f->n++;
+      views[view][h] = _mm256_or_si256(_mm256_slli_epi16(pc, 7), _mm256_or_si256(sq, _mm256_set1_epi16(bucket)));
+    }
   }
+
+  // interleave the views into pairs, unpacking works within 128 bit lanes so put the lanes back in order
+  for (int h = 0; h < 2; h++) {
+    const __m256i lo = _mm256_unpacklo_epi16(views[WHITE][h], views[BLACK][h]);
+    const __m256i hi = _mm256_unpackhi_epi16(views[WHITE][h], views[BLACK][h]);
+
+    _mm256_storeu_si256((__m256i*)features[16 * h], _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*)features[16 * h + 8], _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+
+  return __builtin_popcountll(board->occupancies);
+}
+
+void ToFeatures(Board* board, Features* f) { f->n = WriteFeatures(board, f->features); }
+
+// Featurizes n positions straight into a flat array of pairs, position i's at features[offsets[i]]. Each
+// write runs up to 32 pairs past a position, so features needs that much room beyond the total returned.
+uint64_t WriteFeaturesFlat(Board* boards, uint64_t n, Feature (*features)[2], uint64_t* offsets) {
+  uint64_t offset = 0;
+
+  for (uint64_t i = 0; i < n; i++) {
+    offsets[i] = offset;
+    offset += WriteFeatures(&boards[i], &features[offset]);
+  }
+
+  offsets[n] = offset;
+  return offset;
+}
+
+// Left-right mirror of a position. Bits are reversed within each rank of the occupancies, which
+// also reverses the order of the packed pieces within each rank.
+void MirrorBoard(Board* board, Board* mirrored) {
+  const uint64_t k1 = 0x5555555555555555ULL;
+  const uint64_t k2 = 0x3333333333333333ULL;
+  const uint64_t k4 = 0x0F0F0F0F0F0F0F0FULL;
+
+  uint64_t bb = board->occupancies;
+  bb = ((bb >> 1) & k1) | ((bb & k1) << 1);
+  bb = ((bb >> 2) & k2) | ((bb & k2) << 2);
+  bb = ((bb >> 4) & k4) | ((bb & k4) << 4);
+
+  *mirrored = *board;
+  mirrored->occupancies = bb;
+  mirrored->kings[WHITE] ^= 7;
+  mirrored->kings[BLACK] ^= 7;
+  memset(mirrored->pieces, 0, sizeof(mirrored->pieces));
+
+  for (int rank = 0, start = 0; rank < 8; rank++) {
+    int count = __builtin_popcount((board->occupancies >> (8 * rank)) & 0xFF);
+
+    for (int i = 0; i < count; i++) {
+      int from = start + i, to = start + count - 1 - i;
+      mirrored->pieces[to / 2] |= getPiece(board->pieces, from) << ((to & 1) * 4);
+    }
+
+    start += count;
+  }
+}
+
+// Whether the side to move's king is attacked, found from the enemy pieces' offsets to it. Squares
+// count from a8, so white pawns capture toward the lower ranks of the index.
+int InCheck(Board* board) {
+  const Square king = board->kings[board->stm];
+  const int kr = king >> 3, kf = king & 7;
+
+  uint64_t bb = board->occupancies;
+  for (int n = 0; bb; n++) {
+    Square sq = popLsb(&bb);
+    Piece pc = getPiece(board->pieces, n);
+
+    if (pc / 6 == board->stm) continue;
+
+    const int dr = kr - (sq >> 3), df = kf - (sq & 7);
+    const int ar = abs(dr), af = abs(df);
+
+    switch (pc % 6) {
+      case 0:
+        if (af == 1 && dr == (pc == WHITE_PAWN ? -1 : 1)) return 1;
+        break;
+      case 1:
+        if (ar * af == 2) return 1;
+        break;
+      case 5:
+        if (ar <= 1 && af <= 1) return 1;
+        break;
+      default:
+        // bishops on a diagonal, rooks on a line, queens on either, with nothing in between
+        if ((ar == af && pc % 6 != 3) || ((!ar || !af) && pc % 6 != 2)) {
+          const int step = 8 * ((dr > 0) - (dr < 0)) + (df > 0) - (df < 0);
+
+          int s = sq + step;
+          while (s != king && !(board->occupancies & bit(s))) s += step;
+
+          if (s == king) return 1;
+        }
+    }
+  }
+
+  return 0;
 }
 
 void ParseFen(char* fen, Board* board) {
@@ -18,7 +18,11 @@ INLINE Feature idx(Piece pc, Square sq, Square king, const Color view) {
 
 INLINE Piece getPiece(uint8_t pieces[16], int n) { return (pieces[n / 2] >> ((n & 1) * 4)) & 0xF; }
 
+int WriteFeatures(Board* board, Feature features[32][2]);
+uint64_t WriteFeaturesFlat(Board* boards, uint64_t n, Feature (*features)[2], uint64_t* offsets);
 void ToFeatures(Board* board, Features* f);
+void MirrorBoard(Board* board, Board* mirrored);
+int InCheck(Board* board);
 void ParseFen(char* fen, Board* board);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include "cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+#include "data.h"
+
+const uint32_t CACHE_MAGIC = 'B' | 'F' << 8 | 'C' << 16 | 'H' << 24;
+
+static FeatureCache* AllocFeatureCache(uint64_t n, uint64_t nFeatures) {
+  FeatureCache* cache = malloc(sizeof(FeatureCache));
+
+  cache->n = n;
+  cache->nFeatures = nFeatures;
+  cache->offsets = malloc(sizeof(uint64_t) * (n + 1));
+  // room for WriteFeaturesFlat's writes past the last position
+  cache->features = malloc(sizeof(Feature) * 2 * (nFeatures + 32));
+  cache->stm = malloc(sizeof(uint8_t) * n);
+  cache->wdl = malloc(sizeof(uint8_t) * n);
+  cache->eval = malloc(sizeof(float) * n);
+
+  return cache;
+}
+
+void FreeFeatureCache(FeatureCache* cache) {
+  free(cache->offsets);
+  free(cache->features);
+  free(cache->stm);
+  free(cache->wdl);
+  free(cache->eval);
+  free(cache);
+}
+
+static uint64_t FileSize(char* path) {
+  FILE* fp = fopen(path, "rb");
+  if (fp == NULL) {
+    printf("Cannot open file: %s!\n", path);
+    exit(1);
+  }
+
+  fseek(fp, 0, SEEK_END);
+  uint64_t size = ftell(fp);
+  fclose(fp);
+
+  return size;
+}
+
+FeatureCache* BuildFeatureCache(DataSet* data) {
+  uint64_t nFeatures = 0;
+  for (uint64_t i = 0; i < data->n; i++) nFeatures += __builtin_popcountll(data->entries[i].occupancies);
+
+  FeatureCache* cache = AllocFeatureCache(data->n, nFeatures);
+  WriteFeaturesFlat(data->entries, data->n, cache->features, cache->offsets);
+
+  for (uint64_t i = 0; i < data->n; i++) {
+    Board* board = &data->entries[i];
+
+    cache->stm[i] = board->stm;
+    cache->wdl[i] = board->wdl;
+    cache->eval[i] = board->eval;
+  }
+
+  return cache;
+}
+
+static void WriteFeatureCache(FeatureCache* cache, char* cachePath, uint64_t fileSize) {
+  FILE* fout = fopen(cachePath, "wb");
+  if (fout == NULL) {
+    printf("Unable to write feature cache to %s, it will be rebuilt next run.\n", cachePath);
+    return;
+  }
+
+  CacheHeader header = {.magic = CACHE_MAGIC,
+                        .version = CACHE_VERSION,
+                        .nInput = N_INPUT,
+                        .featureSize = sizeof(Feature),
+                        .fileSize = fileSize,
+                        .n = cache->n,
+                        .nFeatures = cache->nFeatures};
+
+  fwrite(&header, sizeof(CacheHeader), 1, fout);
+  fwrite(cache->offsets, sizeof(uint64_t), cache->n + 1, fout);
+  fwrite(cache->features, sizeof(Feature) * 2, cache->nFeatures, fout);
+  fwrite(cache->stm, sizeof(uint8_t), cache->n, fout);
+  fwrite(cache->wdl, sizeof(uint8_t), cache->n, fout);
+  fwrite(cache->eval, sizeof(float), cache->n, fout);
+
+  fclose(fout);
+}
+
+// Loads the sidecar cache of the first n positions of path, NULL when it is missing, stale or of another n
+FeatureCache* LoadFeatureCache(char* path, uint64_t n) {
+  char cachePath[136];
+  sprintf(cachePath, "%s.fc", path);
+
+  FILE* fin = fopen(cachePath, "rb");
+  if (fin == NULL) return NULL;
+
+  CacheHeader header;
+  if (fread(&header, sizeof(CacheHeader), 1, fin) != 1 || header.magic != CACHE_MAGIC ||
+      header.version != CACHE_VERSION || header.nInput != N_INPUT || header.featureSize != sizeof(Feature) ||
+      header.fileSize != FileSize(path)) {
+    printf("Feature cache %s is stale.\n", cachePath);
+    fclose(fin);
+    return NULL;
+  }
+
+  // up to date, but of another cap (-c or -z) on the positions read
+  if (header.n != n) {
+    printf("Feature cache %s holds the first %" PRIu64 " positions, not the %" PRIu64 " of this cap.\n", cachePath,
+           header.n, n);
+    fclose(fin);
+    return NULL;
+  }
+
+  FeatureCache* cache = AllocFeatureCache(header.n, header.nFeatures);
+
+  if (fread(cache->offsets, sizeof(uint64_t), n + 1, fin) != n + 1 ||
+      fread(cache->features, sizeof(Feature) * 2, header.nFeatures, fin) != header.nFeatures ||
+      fread(cache->stm, sizeof(uint8_t), n, fin) != n || fread(cache->wdl, sizeof(uint8_t), n, fin) != n ||
+      fread(cache->eval, sizeof(float), n, fin) != n) {
+    printf("Feature cache %s is truncated.\n", cachePath);
+    FreeFeatureCache(cache);
+    fclose(fin);
+    return NULL;
+  }
+
+  fclose(fin);
+  return cache;
+}
+
+// Load (or build) the sidecar cache at <path>.fc of the first n positions of a binpack
+FeatureCache* OpenFeatureCache(char* path, uint64_t n) {
+  FeatureCache* cache = LoadFeatureCache(path, n);
+  if (cache) {
+    printf("Loaded %" PRIu64 " featurized positions from %s.fc\n", cache->n, path);
+    return cache;
+  }
+
+  printf("Building feature cache of %s\n", path);
+
+  DataSet data[1] = {{.n = 0, .entries = NULL}};
+  LoadEntriesBinary(path, data, n, 0);
+
+  cache = BuildFeatureCache(data);
+  free(data->entries);
+
+  char cachePath[136];
+  sprintf(cachePath, "%s.fc", path);
+  WriteFeatureCache(cache, cachePath, FileSize(path));
+
+  return cache;
+}
@@ -0,0 +1,11 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "types.h"
+
+FeatureCache* BuildFeatureCache(DataSet* data);
+FeatureCache* LoadFeatureCache(char* path, uint64_t n);
+FeatureCache* OpenFeatureCache(char* path, uint64_t n);
+void FreeFeatureCache(FeatureCache* cache);
+
+#endif
@@ -0,0 +1,959 @@
+#include "check.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+#include "cache.h"
+#include "gradients.h"
+#include "nn.h"
+#include "pool.h"
+#include "random.h"
+#include "trainer.h"
+#include "util.h"
+
+// Allowed error of an optimized kernel, relative to the largest magnitude of the reference output
+#define CHECK_TOLERANCE 1e-4
+// Batch gradients are float sums over thousands of positions, with plenty of cancellation
+#define GRADIENT_TOLERANCE 1e-3
+// A kernel fails once it runs this much slower than its recorded baseline
+#define REGRESSION_TOLERANCE 0.10
+
+#define CHECK_POSITIONS 16384
+#define BENCH_POSITIONS 262144
+#define BENCH_BATCHES 8
+// Throughput is the best of several runs, to keep noise out of the comparison
+#define BENCH_RUNS 5
+
+// A double precision copy of the network's layout, used for weights, moments and gradients alike
+typedef struct {
+  double outputBias;
+  double outputWeights[MAX_L1];
+
+  double l3Biases[N_L3];
+  double l3Weights[N_L3 * N_L2];
+  double l2Biases[N_L2];
+  double l2Weights[N_L2 * MAX_L1];
+
+  double inputBiases[MAX_HIDDEN];
+  double inputWeights[N_INPUT * MAX_HIDDEN];
+} ReferenceNN;
+
+static int failures = 0;
+
+static void Report(const char* name, double err, double tolerance) {
+  int passed = err <= tolerance;
+  failures += !passed;
+
+  printf("%-32s [%s] Error: [%.3e], Tolerance: [%.1e]\n", name, passed ? "PASS" : "FAIL", err, tolerance);
+}
+
+// Max absolute difference, scaled by the largest magnitude in the reference
+static double MaxError(const float* v, const double* ref, size_t n) {
+  double diff = 0.0, scale = 1e-12;
+
+  for (size_t i = 0; i < n; i++) {
+    diff = fmax(diff, fabs(v[i] - ref[i]));
+    scale = fmax(scale, fabs(ref[i]));
+  }
+
+  return diff / scale;
+}
+
+static float RandomFloat(float lo, float hi) { return lo + (hi - lo) * (RandomUInt64() >> 40) / (float)(1 << 24); }
+
+static void RandomBoard(Board* board) {
+  int8_t mailbox[64];
+  memset(mailbox, -1, sizeof(mailbox));
+
+  Square wk = RandomUInt64() % 64, bk;
+  while ((bk = RandomUInt64() % 64) == wk)
+    ;
+
+  mailbox[wk] = WHITE_KING;
+  mailbox[bk] = BLACK_KING;
+
+  const Piece others[10] = {WHITE_PAWN, WHITE_KNIGHT, WHITE_BISHOP, WHITE_ROOK, WHITE_QUEEN,
+                            BLACK_PAWN, BLACK_KNIGHT, BLACK_BISHOP, BLACK_ROOK, BLACK_QUEEN};
+
+  int extra = RandomUInt64() % 31;
+  while (extra) {
+    Square sq = RandomUInt64() % 64;
+    if (mailbox[sq] >= 0) continue;
+
+    mailbox[sq] = others[RandomUInt64() % 10];
+    extra--;
+  }
+
+  memset(board, 0, sizeof(Board));
+  board->kings[WHITE] = wk;
+  board->kings[BLACK] = bk;
+  board->stm = RandomUInt64() & 1;
+  board->wdl = RandomUInt64() % 3;
+  board->eval = RandomFloat(0.0, 1.0);
+
+  int n = 0;
+  for (Square sq = 0; sq < 64; sq++) {
+    if (mailbox[sq] < 0) continue;
+
+    board->occupancies |= 1ULL << sq;
+    board->pieces[n / 2] |= mailbox[sq] << ((n & 1) * 4);
+    n++;
+  }
+}
+
+static void RandomNetwork(NN* nn) {
+  RandomizeNN(nn);
+
+  for (int i = 0; i < N_HIDDEN; i++) nn->inputBiases[i] = RandomFloat(-0.1, 0.1);
+
+  // on a 2^-12 grid the accumulator sums are exact, whatever order an input engine adds rows in
+  for (int i = 0; i < N_INPUT * N_HIDDEN; i++) nn->inputWeights[i] = roundf(nn->inputWeights[i] * 4096) / 4096;
+  for (int i = 0; i < N_HIDDEN; i++) nn->inputBiases[i] = roundf(nn->inputBiases[i] * 4096) / 4096;
+  nn->outputBias = RandomFloat(-0.1, 0.1);
+}
+
+// Straight from the feature definition, one square at a time
+static int ReferenceFeatures(Board* board, Feature features[32][2]) {
+  int n = 0;
+
+  for (Square sq = 0; sq < 64; sq++) {
+    if (!(board->occupancies & (1ULL << sq))) continue;
+
+    Piece pc = (board->pieces[n / 2] >> ((n & 1) * 4)) & 0xF;
+    features[n][WHITE] = idx(pc, sq, board->kings[WHITE], WHITE);
+    features[n][BLACK] = idx(pc, sq, board->kings[BLACK], BLACK);
+    n++;
+  }
+
+  return n;
+}
+
+// The output of post ReLU accumulators, keeping the deep head's activations
+static double ReferenceHead(NN* nn, double* accumulator, double* l2, double* l3) {
+  double output = nn->outputBias;
+
+  if (!DEEP_HEAD) {
+    for (int i = 0; i < N_L1; i++) output += accumulator[i] * nn->outputWeights[i];
+    return output;
+  }
+
+  for (int j = 0; j < N_L2; j++) {
+    l2[j] = nn->l2Biases[j];
+    for (int i = 0; i < N_L1; i++) l2[j] += accumulator[i] * nn->l2Weights[j * N_L1 + i];
+    l2[j] = fmax(0.0, l2[j]);
+  }
+
+  for (int j = 0; j < N_L3; j++) {
+    l3[j] = nn->l3Biases[j];
+    for (int i = 0; i < N_L2; i++) l3[j] += l2[i] * nn->l3Weights[j * N_L2 + i];
+    l3[j] = fmax(0.0, l3[j]);
+  }
+
+  for (int i = 0; i < N_L3; i++) output += l3[i] * nn->outputWeights[i];
+  return output;
+}
+
+static double ReferencePredict(NN* nn, Board* board, double* accumulator) {
+  Feature features[32][2];
+  int n = ReferenceFeatures(board, features);
+
+  for (int j = 0; j < N_HIDDEN; j++) {
+    double stm = nn->inputBiases[j], xstm = nn->inputBiases[j];
+
+    for (int i = 0; i < n; i++) {
+      stm += nn->inputWeights[features[i][board->stm] * N_HIDDEN + j];
+      xstm += nn->inputWeights[features[i][board->stm ^ 1] * N_HIDDEN + j];
+    }
+
+    // clipped to the engine's range when training quantization aware
+    accumulator[j] = fmin(QAT ? CRELU_CLIP : INFINITY, fmax(0.0, stm));
+    accumulator[j + N_HIDDEN] = fmin(QAT ? CRELU_CLIP : INFINITY, fmax(0.0, xstm));
+  }
+
+  double l2[N_L2], l3[N_L3];
+  return ReferenceHead(nn, accumulator, l2, l3);
+}
+
+static double ReferenceSigmoid(double s) { return 1.0 / (1.0 + exp(-s * SS)); }
+
+static double ReferenceError(double r, Board* board) {
+  return WDL * pow(fabs(r - board->wdl / 2.0), 2.5) + EVAL * pow(fabs(r - board->eval), 2.5);
+}
+
+static double ReferenceErrorGradient(double r, Board* board) {
+  double w = r - board->wdl / 2.0, e = r - board->eval;
+  return WDL * 2.5 * w * sqrt(fabs(w)) + EVAL * 2.5 * e * sqrt(fabs(e));
+}
+
+// Per sample gradients of a single position, accumulated into grads
+static double ReferenceBackprop(NN* nn, Board* board, ReferenceNN* grads, uint8_t* active) {
+  double accumulator[MAX_L1];
+  double out = ReferenceSigmoid(ReferencePredict(nn, board, accumulator));
+
+  double outputLoss = out * (1.0 - out) * SS * ReferenceErrorGradient(out, board);
+
+  // every ReLU mask comes from the float kernels, a pre-activation within rounding of zero can land on
+  // either side and would show up as a spurious gradient error (the kernels are CheckPredict's job)
+  Features f[1];
+  float activations[MAX_L1] ALIGN64, raw;
+  HeadTrace trace[1];
+  ToFeatures(board, f);
+  NNAccumulate(nn, f, board->stm, activations);
+  HeadForward(nn, activations, 1, trace, &raw);
+
+  // the head, from the loss of the output to the loss of each (post ReLU) accumulator
+  double l2[N_L2], l3[N_L3], inputLosses[MAX_L1];
+  ReferenceHead(nn, accumulator, l2, l3);
+
+  grads->outputBias += outputLoss;
+
+  if (!DEEP_HEAD) {
+    for (int i = 0; i < N_L1; i++) {
+      grads->outputWeights[i] += accumulator[i] * outputLoss;
+      inputLosses[i] = outputLoss * nn->outputWeights[i];
+    }
+  } else {
+    double l3Losses[N_L3], l2Losses[N_L2] = {0};
+
+    for (int i = 0; i < N_L3; i++) {
+      grads->outputWeights[i] += l3[i] * outputLoss;
+      l3Losses[i] = outputLoss * nn->outputWeights[i] * (trace->l3[0][i] > 0);
+    }
+
+    for (int j = 0; j < N_L3; j++) {
+      grads->l3Biases[j] += l3Losses[j];
+      for (int i = 0; i < N_L2; i++) {
+        grads->l3Weights[j * N_L2 + i] += l2[i] * l3Losses[j];
+        l2Losses[i] += nn->l3Weights[j * N_L2 + i] * l3Losses[j];
+      }
+    }
+
+    for (int i = 0; i < N_L2; i++) l2Losses[i] *= trace->l2[0][i] > 0;
+
+    for (int i = 0; i < N_L1; i++) inputLosses[i] = 0.0;
+
+    for (int j = 0; j < N_L2; j++) {
+      grads->l2Biases[j] += l2Losses[j];
+      for (int i = 0; i < N_L1; i++) {
+        grads->l2Weights[j * N_L1 + i] += accumulator[i] * l2Losses[j];
+        inputLosses[i] += nn->l2Weights[j * N_L1 + i] * l2Losses[j];
+      }
+    }
+  }
+
+  const float clip = QAT ? CRELU_CLIP : FLT_MAX;
+
+  double hidden[MAX_L1];
+  for (int i = 0; i < N_L1; i++)
+    hidden[i] = (inputLosses[i] + LAMBDA) * (activations[i] > 0 && activations[i] < clip);
+
+  for (int j = 0; j < N_HIDDEN; j++) grads->inputBiases[j] += hidden[j] + hidden[j + N_HIDDEN];
+
+  Feature features[32][2];
+  int n = ReferenceFeatures(board, features);
+
+  for (int i = 0; i < n; i++) {
+    int f1 = features[i][board->stm];
+    int f2 = features[i][board->stm ^ 1];
+
+    active[f1] = active[f2] = 1;
+
+    for (int j = 0; j < N_HIDDEN; j++) {
+      grads->inputWeights[f1 * N_HIDDEN + j] += hidden[j];
+      grads->inputWeights[f2 * N_HIDDEN + j] += hidden[j + N_HIDDEN];
+    }
+  }
+
+  return ReferenceError(out, board);
+}
+
+static void ReferenceAdam(double* v, double* M, double* V, double g, int age) {
+  *M = pow(BETA1, age) * *M + (1.0 - BETA1) * g;
+  *V = pow(BETA2, age) * *V + (1.0 - BETA2) * g * g;
+
+  *v -= ALPHA * *M / (sqrt(*V) + EPSILON);
+}
+
+static void CheckVectorKernels() {
+  const size_t sizes[] = {8, 13, 24, 1000, N_L1};
+
+  float a[MAX_L1] ALIGN64, b[MAX_L1] ALIGN64, relu[MAX_L1] ALIGN64;
+  double ref[MAX_L1];
+
+  double dotError = 0.0, reluError = 0.0;
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    const size_t n = sizes[s];
+
+    double dot = 0.0;
+    for (size_t i = 0; i < n; i++) {
+      a[i] = relu[i] = RandomFloat(-1, 1);
+      b[i] = RandomFloat(-1, 1);
+
+      dot += (double)a[i] * b[i];
+      ref[i] = fmax(0.0, a[i]);
+    }
+
+    ReLU(relu, n);
+
+    dotError = fmax(dotError, fabs(DotProduct(a, b, n) - dot) / fmax(1.0, fabs(dot)));
+    reluError = fmax(reluError, MaxError(relu, ref, n));
+  }
+
+  Report("DotProduct", dotError, CHECK_TOLERANCE);
+  Report("ReLU", reluError, 0.0);
+}
+
+// The vectorized featurizer, one position at a time and into a flat array, against the definition
+static void CheckFeatures(DataSet* data) {
+  uint64_t mismatched = 0, flatMismatched = 0;
+
+  Feature (*flat)[2] = malloc(sizeof(Feature) * 2 * (32 * data->n + 32));
+  uint64_t* offsets = malloc(sizeof(uint64_t) * (data->n + 1));
+  WriteFeaturesFlat(data->entries, data->n, flat, offsets);
+
+  for (uint64_t i = 0; i < data->n; i++) {
+    Feature expected[32][2];
+    int n = ReferenceFeatures(&data->entries[i], expected);
+
+    Features f[1];
+    ToFeatures(&data->entries[i], f);
+
+    mismatched += f->n != n || memcmp(f->features, expected, sizeof(Feature) * 2 * n) != 0;
+    flatMismatched += offsets[i + 1] - offsets[i] != (uint64_t)n ||
+                      memcmp(flat[offsets[i]], expected, sizeof(Feature) * 2 * n) != 0;
+  }
+
+  Report("ToFeatures", mismatched, 0.0);
+  Report("WriteFeaturesFlat", flatMismatched, 0.0);
+
+  free(flat);
+  free(offsets);
+}
+
+static int CompareFeatures(const void* a, const void* b) { return *(Feature*)a - *(Feature*)b; }
+
+// Each perspective is oriented by its own king's file, so a mirrored position must produce the
+// same set of features (and with it the same evaluation) as the original.
+static void CheckMirror(DataSet* data) {
+  uint64_t roundTrip = 0, mismatched = 0;
+
+  for (uint64_t i = 0; i < data->n; i++) {
+    Board* board = &data->entries[i];
+
+    Board mirrored[1], restored[1];
+    MirrorBoard(board, mirrored);
+    MirrorBoard(mirrored, restored);
+
+    roundTrip += memcmp(board, restored, sizeof(Board)) != 0;
+
+    Feature original[32][2], flipped[32][2];
+    int n = ReferenceFeatures(board, original);
+    ReferenceFeatures(mirrored, flipped);
+
+    for (Color view = WHITE; view <= BLACK; view++) {
+      Feature a[32], b[32];
+      for (int j = 0; j < n; j++) a[j] = original[j][view], b[j] = flipped[j][view];
+
+      qsort(a, n, sizeof(Feature), CompareFeatures);
+      qsort(b, n, sizeof(Feature), CompareFeatures);
+
+      mismatched += memcmp(a, b, sizeof(Feature) * n) != 0;
+    }
+  }
+
+  Report("MirrorBoard round trip", roundTrip, 0.0);
+  Report("Mirrored feature sets", mismatched, 0.0);
+}
+
+static void CheckCache(NN* nn, DataSet* data) {
+  FeatureCache* cache = BuildFeatureCache(data);
+
+  float cached = CacheError(cache, nn), direct = TotalError(data, nn);
+  Report("CacheError", fabs(cached - direct) / fmax(1e-12, direct), CHECK_TOLERANCE);
+
+  FreeFeatureCache(cache);
+}
+
+// Straight from the engine's fixed point format, the master weight clamped to the int16 range and rounded
+static float ReferenceQuantize(float w, double scale) {
+  return round(fmin(32767.0, fmax(-32768.0, w * scale))) / scale;
+}
+
+// Largest difference between any weight of two nets
+static double NetDifference(NN* a, NN* b) {
+  double diff = fabs(a->outputBias - b->outputBias);
+
+  for (int i = 0; i < N_INPUT * N_HIDDEN; i++) diff = fmax(diff, fabs(a->inputWeights[i] - b->inputWeights[i]));
+  for (int i = 0; i < N_HIDDEN; i++) diff = fmax(diff, fabs(a->inputBiases[i] - b->inputBiases[i]));
+  for (int i = 0; i < N_L1; i++) diff = fmax(diff, fabs(a->outputWeights[i] - b->outputWeights[i]));
+
+  return diff;
+}
+
+static double GridError(const float* v, size_t n, double scale) {
+  double err = 0.0;
+
+  for (size_t i = 0; i < n; i++) {
+    double q = v[i] * scale;
+    err = fmax(err, fabs(q - round(q)) + fmax(0.0, fabs(q) - 32768.0));
+  }
+
+  return err;
+}
+
+static void CheckQuantize(NN* nn, DataSet* data) {
+  NN* quantized = AlignedMalloc(sizeof(NN));
+  NN* master = AlignedMalloc(sizeof(NN));
+  memcpy(master, nn, sizeof(NN));
+
+  QuantizeNN(quantized, master, NULL);
+
+  Report("QuantizeNN input weights", GridError(quantized->inputWeights, N_INPUT * N_HIDDEN, QUANT_IN), 1e-3);
+  Report("QuantizeNN input biases", GridError(quantized->inputBiases, N_HIDDEN, QUANT_IN), 1e-3);
+  Report("QuantizeNN output weights", GridError(quantized->outputWeights, N_L1, QUANT_OUT), 1e-3);
+
+  // the clipped forward pass never leaves the quantized range
+  QAT = 1;
+  double clipError = 0.0;
+  for (uint64_t i = 0; i < 64; i++) {
+    Features f[1];
+    float accumulator[MAX_L1] ALIGN64;
+
+    ToFeatures(&data->entries[i], f);
+    NNAccumulate(quantized, f, data->entries[i].stm, accumulator);
+
+    for (int j = 0; j < N_L1; j++) clipError = fmax(clipError, fmax(0.0, accumulator[j] - CRELU_CLIP));
+  }
+  QAT = 0;
+
+  Report("CReLU clip", clipError, 0.0);
+
+  AlignedFree(quantized);
+  AlignedFree(master);
+}
+
+static void CheckPredict(NN* nn, DataSet* data) {
+  double outputError = 0.0, accumulatorError = 0.0, scale = 1e-12;
+
+  for (uint64_t i = 0; i < data->n; i++) {
+    Board* board = &data->entries[i];
+
+    NetworkTrace trace[1];
+    Features f[1];
+
+    ToFeatures(board, f);
+    NNPredict(nn, f, board->stm, trace);
+
+    double accumulator[MAX_L1];
+    double output = ReferencePredict(nn, board, accumulator);
+
+    outputError = fmax(outputError, fabs(trace->output - output));
+    scale = fmax(scale, fabs(output));
+
+    accumulatorError = fmax(accumulatorError, MaxError(trace->accumulator, accumulator, N_L1));
+  }
+
+  Report("NNPredict output", outputError / scale, CHECK_TOLERANCE);
+  Report("NNPredict accumulator", accumulatorError, CHECK_TOLERANCE);
+}
+
+static void CheckTrain(NN* nn, DataSet* data, Features* features, BatchGradients* local, uint8_t* active,
+                       BatchGradients* summed) {
+  ReferenceNN* ref = calloc(1, sizeof(ReferenceNN));
+  uint8_t refActive[N_INPUT] = {0};
+
+  double refError = 0.0;
+  for (uint64_t i = 0; i < data->n; i++) refError += ReferenceBackprop(nn, &data->entries[i], ref, refActive);
+  refError /= data->n;
+
+  memset(active, 0, N_INPUT);
+  float error = Train(0, data, features, nn, local, active);
+
+  memset(summed, 0, sizeof(BatchGradients));
+  for (int t = 0; t < THREADS; t++) {
+    summed->outputBias += local[t].outputBias;
+    for (int i = 0; i < N_L1; i++) summed->outputWeights[i] += local[t].outputWeights[i];
+    for (int i = 0; i < N_HIDDEN; i++) summed->inputBiases[i] += local[t].inputBiases[i];
+    for (int i = 0; i < N_INPUT * N_HIDDEN; i++) summed->inputWeights[i] += local[t].inputWeights[i];
+
+    for (int i = 0; i < N_L3; i++) summed->l3Biases[i] += local[t].l3Biases[i];
+    for (int i = 0; i < N_L3 * N_L2; i++) summed->l3Weights[i] += local[t].l3Weights[i];
+    for (int i = 0; i < N_L2; i++) summed->l2Biases[i] += local[t].l2Biases[i];
+    for (int i = 0; i < N_L2 * N_L1; i++) summed->l2Weights[i] += local[t].l2Weights[i];
+  }
+
+  Report("Train error", fabs(error - refError) / fmax(1e-12, refError), CHECK_TOLERANCE);
+  Report("Train output bias", MaxError(&summed->outputBias, &ref->outputBias, 1), GRADIENT_TOLERANCE);
+  Report("Train output weights", MaxError(summed->outputWeights, ref->outputWeights, N_L1), GRADIENT_TOLERANCE);
+  if (DEEP_HEAD) {
+    Report("Train L3 biases", MaxError(summed->l3Biases, ref->l3Biases, N_L3), GRADIENT_TOLERANCE);
+    Report("Train L3 weights", MaxError(summed->l3Weights, ref->l3Weights, N_L3 * N_L2), GRADIENT_TOLERANCE);
+    Report("Train L2 biases", MaxError(summed->l2Biases, ref->l2Biases, N_L2), GRADIENT_TOLERANCE);
+    Report("Train L2 weights", MaxError(summed->l2Weights, ref->l2Weights, N_L2 * N_L1), GRADIENT_TOLERANCE);
+  }
+  Report("Train input biases", MaxError(summed->inputBiases, ref->inputBiases, N_HIDDEN), GRADIENT_TOLERANCE);
+  Report("Train input weights", MaxError(summed->inputWeights, ref->inputWeights, N_INPUT * N_HIDDEN),
+         GRADIENT_TOLERANCE);
+  Report("Train active rows", memcmp(active, refActive, N_INPUT) != 0, 0.0);
+
+  free(ref);
+}
+
+// Train against the fake-quantized copy of a master net, either with half of the hidden neurons biased onto
+// the clip so positions land on both sides of it, or with weights past what the grid holds. The gradients are
+// those of the quantized net, which the optimizer applies to the (clamped) master weights straight through.
+static void CheckQuantizedTrain(NN* nn, int pastGrid, DataSet* data, Features* features, BatchGradients* local,
+                                uint8_t* active, BatchGradients* summed) {
+  NN* master = AlignedMalloc(sizeof(NN));
+  NN* quantized = AlignedMalloc(sizeof(NN));
+  NN* reference = AlignedMalloc(sizeof(NN));
+  memcpy(master, nn, sizeof(NN));
+
+  if (!pastGrid) {
+    for (int i = 0; i < N_HIDDEN; i += 2) master->inputBiases[i] = CRELU_CLIP + RandomFloat(-0.5, 0.5);
+  } else {
+    for (int i = 0; i < 64; i++)
+      master->inputWeights[RandomUInt64() % (N_INPUT * N_HIDDEN)] = (i & 1 ? 1.25 : -1.25) * 32768 / QUANT_IN;
+    master->outputWeights[1] = 1.25 * 32768 / QUANT_OUT;
+    master->outputWeights[N_HIDDEN + 1] = -1.25 * 32768 / QUANT_OUT;
+  }
+
+  memcpy(reference, master, sizeof(NN));
+  for (int i = 0; i < N_INPUT * N_HIDDEN; i++)
+    reference->inputWeights[i] = ReferenceQuantize(master->inputWeights[i], QUANT_IN);
+  for (int i = 0; i < N_HIDDEN; i++) reference->inputBiases[i] = ReferenceQuantize(master->inputBiases[i], QUANT_IN);
+  for (int i = 0; i < N_L1; i++) reference->outputWeights[i] = ReferenceQuantize(master->outputWeights[i], QUANT_OUT);
+  reference->outputBias = round(master->outputBias * QUANT_IN * QUANT_OUT) / (QUANT_IN * QUANT_OUT);
+
+  QuantizeNN(quantized, master, NULL);
+  Report("QuantizeNN reference", NetDifference(quantized, reference), 0.0);
+
+  // the master keeps its clamped value, it moves on from where the quantized net is
+  double clampError = 0.0;
+  for (int i = 0; i < N_INPUT * N_HIDDEN; i++)
+    clampError = fmax(clampError, fabs(master->inputWeights[i] * QUANT_IN) - 32768.0);
+  for (int i = 0; i < N_L1; i++) clampError = fmax(clampError, fabs(master->outputWeights[i] * QUANT_OUT) - 32768.0);
+  Report("QuantizeNN master clamp", fmax(0.0, clampError), 0.0);
+
+  QAT = 1;
+
+  int below = 0, clipped = 0;
+  for (uint64_t i = 0; i < data->n; i++) {
+    Features f[1];
+    float accumulator[MAX_L1] ALIGN64;
+
+    ToFeatures(&data->entries[i], f);
+    NNAccumulate(quantized, f, data->entries[i].stm, accumulator);
+
+    for (int j = 0; j < N_L1; j++) {
+      below += accumulator[j] > 0 && accumulator[j] < CRELU_CLIP;
+      clipped += accumulator[j] == CRELU_CLIP;
+    }
+  }
+  Report("QAT activations either side", !below || !clipped, 0.0);
+
+  INPUT_ENGINE = FEATURE_MAJOR;
+  printf("%s, feature-major input engine:\n", pastGrid ? "Weights past the grid" : "Activations about the clip");
+  CheckTrain(quantized, data, features, local, active, summed);
+  INPUT_ENGINE = POSITION_MAJOR;
+  printf("%s, position-major input engine:\n", pastGrid ? "Weights past the grid" : "Activations about the clip");
+  CheckTrain(quantized, data, features, local, active, summed);
+
+  QAT = 0;
+
+  AlignedFree(master);
+  AlignedFree(quantized);
+  AlignedFree(reference);
+}
+
+static void CheckApplyGradients(NN* nn, BatchGradients* local, uint8_t* active, BatchGradients* summed) {
+  NNGradients* grads = malloc(sizeof(NNGradients));
+  NN* before = AlignedMalloc(sizeof(NN));
+
+  // optimizer state part way through training, with rows last seen a few steps ago
+  for (int i = 0; i < N_INPUT * N_HIDDEN; i++)
+    grads->inputWeights[i] = (Gradient){.M = RandomFloat(-1e-3, 1e-3), .V = RandomFloat(0, 1e-6)};
+  for (int i = 0; i < N_HIDDEN; i++)
+    grads->inputBiases[i] = (Gradient){.M = RandomFloat(-1e-3, 1e-3), .V = RandomFloat(0, 1e-6)};
+  for (int i = 0; i < N_L1; i++)
+    grads->outputWeights[i] = (Gradient){.M = RandomFloat(-1e-3, 1e-3), .V = RandomFloat(0, 1e-6)};
+  grads->outputBias = (Gradient){.M = RandomFloat(-1e-3, 1e-3), .V = RandomFloat(0, 1e-6)};
+
+  ITERATION = 100;
+  for (int i = 0; i < N_INPUT; i++) LAST_SEEN[i] = ITERATION - 1 - RandomUInt64() % 8;
+
+  // reference step, in double, on copies
+  ReferenceNN* weights = malloc(sizeof(ReferenceNN));
+  ReferenceNN* M = malloc(sizeof(ReferenceNN));
+  ReferenceNN* V = malloc(sizeof(ReferenceNN));
+
+  for (int i = 0; i < N_INPUT; i++) {
+    for (int j = 0; j < N_HIDDEN; j++) {
+      int x = i * N_HIDDEN + j;
+
+      weights->inputWeights[x] = nn->inputWeights[x];
+      M->inputWeights[x] = grads->inputWeights[x].M;
+      V->inputWeights[x] = grads->inputWeights[x].V;
+
+      if (active[i])
+        ReferenceAdam(&weights->inputWeights[x], &M->inputWeights[x], &V->inputWeights[x], summed->inputWeights[x],
+                      ITERATION - LAST_SEEN[i]);
+    }
+  }
+
+  for (int i = 0; i < N_HIDDEN; i++) {
+    weights->inputBiases[i] = nn->inputBiases[i];
+    M->inputBiases[i] = grads->inputBiases[i].M;
+    V->inputBiases[i] = grads->inputBiases[i].V;
+
+    ReferenceAdam(&weights->inputBiases[i], &M->inputBiases[i], &V->inputBiases[i], summed->inputBiases[i], 1);
+  }
+
+  for (int i = 0; i < N_L1; i++) {
+    weights->outputWeights[i] = nn->outputWeights[i];
+    M->outputWeights[i] = grads->outputWeights[i].M;
+    V->outputWeights[i] = grads->outputWeights[i].V;
+
+    ReferenceAdam(&weights->outputWeights[i], &M->outputWeights[i], &V->outputWeights[i], summed->outputWeights[i],
+                  1);
+  }
+
+  weights->outputBias = nn->outputBias;
+  M->outputBias = grads->outputBias.M;
+  V->outputBias = grads->outputBias.V;
+  ReferenceAdam(&weights->outputBias, &M->outputBias, &V->outputBias, summed->outputBias, 1);
+
+  memcpy(before, nn, sizeof(NN));
+  ApplyGradients(nn, grads, local, active);
+
+  // compare the steps taken rather than the weights, which barely move
+  double inputStep = 0.0, inputScale = 1e-12, moment = 0.0, momentScale = 1e-12;
+  for (int i = 0; i < N_INPUT * N_HIDDEN; i++) {
+    inputStep = fmax(inputStep, fabs((nn->inputWeights[i] - before->inputWeights[i]) -
+                                     (weights->inputWeights[i] - before->inputWeights[i])));
+    inputScale = fmax(inputScale, fabs(weights->inputWeights[i] - before->inputWeights[i]));
+
+    moment = fmax(moment, fabs(grads->inputWeights[i].M - M->inputWeights[i]));
+    momentScale = fmax(momentScale, fabs(M->inputWeights[i]));
+  }
+
+  double otherStep = 0.0, otherScale = 1e-12;
+  for (int i = 0; i < N_HIDDEN; i++) {
+    otherStep = fmax(otherStep, fabs((nn->inputBiases[i] - before->inputBiases[i]) -
+                                     (weights->inputBiases[i] - before->inputBiases[i])));
+    otherScale = fmax(otherScale, fabs(weights->inputBiases[i] - before->inputBiases[i]));
+  }
+  for (int i = 0; i < N_L1; i++) {
+    otherStep = fmax(otherStep, fabs((nn->outputWeights[i] - before->outputWeights[i]) -
+                                     (weights->outputWeights[i] - before->outputWeights[i])));
+    otherScale = fmax(otherScale, fabs(weights->outputWeights[i] - before->outputWeights[i]));
+  }
+
+  // float weights can only resolve a step to a few ulps of the weight itself
+  Report("ApplyGradients input step", inputStep / inputScale, 1e-3);
+  Report("ApplyGradients input moments", moment / momentScale, CHECK_TOLERANCE);
+  Report("ApplyGradients bias/output step", otherStep / otherScale, 1e-3);
+
+  free(weights);
+  free(M);
+  free(V);
+  AlignedFree(before);
+  free(grads);
+}
+
+// The pipeline, driven as the main loop drives it. The first batch's step of another net runs beside
+// the second batch and must match ApplyGradients on the same gradients, stepping every weight once
+// and handing the gradients back cleared for the next Train.
+static void CheckPipeline(NN* nn, DataSet* data, BatchGradients* local, uint8_t* active) {
+  NN* sequential = AlignedMalloc(sizeof(NN));
+  NN* pipelined = AlignedMalloc(sizeof(NN));
+  NN* last = AlignedMalloc(sizeof(NN));
+  NNGradients* sequentialGrads = calloc(1, sizeof(NNGradients));
+  NNGradients* pipelinedGrads = calloc(1, sizeof(NNGradients));
+  NNGradients* lastGrads = calloc(1, sizeof(NNGradients));
+  BatchGradients* next = AlignedMalloc(sizeof(BatchGradients) * THREADS);
+  int* lastSeen = malloc(sizeof(int) * N_INPUT);
+  uint8_t nextActive[N_INPUT] = {0};
+
+  memcpy(sequential, nn, sizeof(NN));
+  memcpy(pipelined, nn, sizeof(NN));
+  memcpy(last, nn, sizeof(NN));
+
+  ClearLocal(local);
+  ClearLocal(next);
+  memset(active, 0, N_INPUT);
+
+  Pipeline pipeline[1] = {{.pending = 0}};
+
+  ITERATION++;
+  float error = TrainPipelined(pipeline, 0, data, NULL, nn, pipelined, pipelinedGrads, local, active);
+
+  // the reference step, on the gradients the pipeline has yet to consume
+  memcpy(lastSeen, LAST_SEEN, sizeof(int) * N_INPUT);
+  ApplyGradients(sequential, sequentialGrads, local, active);
+  memcpy(LAST_SEEN, lastSeen, sizeof(int) * N_INPUT);
+
+  ITERATION++;
+  float overlapped = TrainPipelined(pipeline, 0, data, NULL, nn, last, lastGrads, next, nextActive);
+  FinishPending(pipeline);
+
+  int dirty = 0;
+  for (int t = 0; t < THREADS; t++) {
+    dirty += local[t].outputBias != 0;
+    for (int i = 0; i < N_L1; i++) dirty += local[t].outputWeights[i] != 0;
+    for (int i = 0; i < N_HIDDEN; i++) dirty += local[t].inputBiases[i] != 0;
+    for (int i = 0; i < N_INPUT * N_HIDDEN; i++) dirty += local[t].inputWeights[i] != 0;
+  }
+
+  Report("Pipeline step", memcmp(pipelined, sequential, sizeof(NN)) != 0, 0.0);
+  Report("Pipeline optimizer state", memcmp(pipelinedGrads, sequentialGrads, sizeof(NNGradients)) != 0, 0.0);
+  Report("Pipeline train error", fabs(overlapped - error) / fmax(1e-12, error), CHECK_TOLERANCE);
+  Report("Pipeline active rows", memcmp(active, nextActive, N_INPUT) != 0, 0.0);
+  Report("Pipeline consumed gradients", dirty, 0.0);
+
+  AlignedFree(sequential);
+  AlignedFree(pipelined);
+  AlignedFree(last);
+  free(sequentialGrads);
+  free(pipelinedGrads);
+  free(lastGrads);
+  AlignedFree(next);
+  free(lastSeen);
+}
+
+static double BenchPredict(NN* nn, DataSet* data) {
+  double best = 0.0;
+
+  for (int r = 0; r < BENCH_RUNS; r++) {
+    long start = GetTimeMS();
+
+    float sink = 0.0;
+    for (uint64_t i = 0; i < BENCH_POSITIONS; i++) {
+      Board* board = &data->entries[i % data->n];
+
+      NetworkTrace trace[1];
+      Features f[1];
+
+      ToFeatures(board, f);
+      NNPredict(nn, f, board->stm, trace);
+      sink += trace->output;
+    }
+
+    long elapsed = GetTimeMS() - start;
+    if (isnan(sink)) printf("NaN while benchmarking NNPredict!\n");
+
+    best = fmax(best, 1000.0 * BENCH_POSITIONS / (elapsed > 0 ? elapsed : 1));
+  }
+
+  return best;
+}
+
+static double BenchFeaturize(DataSet* data) {
+  double best = 0.0;
+
+  for (int r = 0; r < BENCH_RUNS; r++) {
+    long start = GetTimeMS();
+
+    // far cheaper than a prediction, so many more of them
+    int sink = 0;
+    for (uint64_t i = 0; i < 16 * BENCH_POSITIONS; i++) {
+      Features f[1];
+      ToFeatures(&data->entries[i % data->n], f);
+      sink += f->n + f->features[i % f->n][i & 1];
+    }
+
+    long elapsed = GetTimeMS() - start;
+    if (sink == -1) printf("Impossible sum while benchmarking ToFeatures!\n");
+
+    best = fmax(best, 1000.0 * 16 * BENCH_POSITIONS / (elapsed > 0 ? elapsed : 1));
+  }
+
+  return best;
+}
+
+static double BenchTrain(NN* nn, DataSet* data, BatchGradients* local) {
+  uint8_t active[N_INPUT];
+  double best = 0.0;
+
+  for (int r = 0; r < BENCH_RUNS; r++) {
+    long start = GetTimeMS();
+
+    for (int b = 0; b < BENCH_BATCHES; b++) Train(0, data, NULL, nn, local, active);
+
+    long elapsed = GetTimeMS() - start;
+    best = fmax(best, 1000.0 * BENCH_BATCHES * BATCH_SIZE / (elapsed > 0 ? elapsed : 1));
+  }
+
+  return best;
+}
+
+static double BenchApplyGradients(NN* nn, BatchGradients* local, uint8_t* active) {
+  NNGradients* grads = calloc(1, sizeof(NNGradients));
+  double best = 0.0;
+
+  for (int r = 0; r < BENCH_RUNS; r++) {
+    long start = GetTimeMS();
+
+    for (int b = 0; b < BENCH_BATCHES; b++) {
+      ITERATION++;
+      ApplyGradients(nn, grads, local, active);
+    }
+
+    long elapsed = GetTimeMS() - start;
+    best = fmax(best, 1000.0 * BENCH_BATCHES / (elapsed > 0 ? elapsed : 1));
+  }
+
+  free(grads);
+
+  return best;
+}
+
+// Compare against the recorded baseline of the same name, or record one if there isn't any
+static void CheckThroughput(char* path, const char* name, double value, const char* unit) {
+  char key[64];
+  sprintf(key, "%s@%d", name, THREADS);
+
+  double baseline = 0.0;
+
+  FILE* fp = fopen(path, "r");
+  if (fp) {
+    char k[64];
+    double v;
+    while (fscanf(fp, "%63s %lf", k, &v) == 2)
+      if (!strcmp(k, key)) baseline = v;
+
+    fclose(fp);
+  }
+
+  if (baseline <= 0) {
+    fp = fopen(path, "a");
+    if (fp == NULL) printf("Unable to write baseline to %s!\n", path), exit(1);
+
+    fprintf(fp, "%s %.1f\n", key, value);
+    fclose(fp);
+
+    printf("%-32s [ REC] Speed: [%12.1f %s]\n", key, value, unit);
+    return;
+  }
+
+  int passed = value >= (1.0 - REGRESSION_TOLERANCE) * baseline;
+  failures += !passed;
+
+  printf("%-32s [%s] Speed: [%12.1f %s], Baseline: [%12.1f %s], Change: [%+6.1f%%]\n", key, passed ? "PASS" : "FAIL",
+         value, unit, baseline, unit, 100.0 * (value - baseline) / baseline);
+}
+
+// The sized kernels of another hidden size, on a fresh net of that size
+static void CheckHidden(int hidden, DataSet* data, DataSet* batch, Features* features, BatchGradients* local,
+                        uint8_t* active, BatchGradients* summed) {
+  const int current = N_HIDDEN;
+  SetHidden(hidden);
+
+  NN* nn = AlignedMalloc(sizeof(NN));
+  RandomNetwork(nn);
+
+  printf("Hidden size %d:\n", hidden);
+  CheckPredict(nn, data);
+  CheckCache(nn, data);
+  printf("Hidden size %d, feature-major input engine:\n", hidden);
+  INPUT_ENGINE = FEATURE_MAJOR;
+  CheckTrain(nn, batch, features, local, active, summed);
+  printf("Hidden size %d, position-major input engine:\n", hidden);
+  INPUT_ENGINE = POSITION_MAJOR;
+  CheckTrain(nn, batch, features, local, active, summed);
+
+  AlignedFree(nn);
+  SetHidden(current);
+}
+
+int RunChecks(char* baselinePath) {
+  NN* nn = AlignedMalloc(sizeof(NN));
+  RandomNetwork(nn);
+
+  DataSet data[1];
+  data->n = CHECK_POSITIONS > BATCH_SIZE ? CHECK_POSITIONS : BATCH_SIZE;
+  data->entries = malloc(sizeof(Board) * data->n);
+  for (uint64_t i = 0; i < data->n; i++) RandomBoard(&data->entries[i]);
+
+  BatchGradients* local = AlignedMalloc(sizeof(BatchGradients) * THREADS);
+  BatchGradients* summed = AlignedMalloc(sizeof(BatchGradients));
+  uint8_t active[N_INPUT];
+
+  printf("Checking kernels against their scalar references...\n");
+
+  CheckVectorKernels();
+  CheckFeatures(data);
+  CheckMirror(data);
+  CheckPredict(nn, data);
+  CheckCache(nn, data);
+  CheckQuantize(nn, data);
+
+  DataSet batch[1] = {{.n = BATCH_SIZE, .entries = data->entries}};
+  Features* features = malloc(sizeof(Features) * BATCH_SIZE);
+  FeaturizeBatch(batch->entries, BATCH_SIZE, features);
+
+  INPUT_ENGINE = FEATURE_MAJOR;
+  printf("Feature-major input engine:\n");
+  CheckTrain(nn, batch, NULL, local, active, summed);
+  printf("Feature-major input engine, shared features:\n");
+  CheckTrain(nn, batch, features, local, active, summed);
+
+  INPUT_ENGINE = POSITION_MAJOR;
+  printf("Position-major input engine, shared features:\n");
+  CheckTrain(nn, batch, features, local, active, summed);
+  printf("Position-major input engine:\n");
+  CheckTrain(nn, batch, NULL, local, active, summed);
+  CheckApplyGradients(nn, local, active, summed);
+  printf("Quantization aware training:\n");
+  CheckQuantizedTrain(nn, 0, batch, features, local, active, summed);
+  CheckQuantizedTrain(nn, 1, batch, features, local, active, summed);
+  printf("Pipelined optimizer step:\n");
+  CheckPipeline(nn, batch, local, active);
+
+  DEEP_HEAD = 1;
+  NN* deep = AlignedMalloc(sizeof(NN));
+  RandomNetwork(deep);
+
+  printf("Deep head:\n");
+  CheckPredict(deep, data);
+  CheckCache(deep, data);
+  printf("Deep head, feature-major input engine:\n");
+  INPUT_ENGINE = FEATURE_MAJOR;
+  CheckTrain(deep, batch, features, local, active, summed);
+  printf("Deep head, position-major input engine:\n");
+  INPUT_ENGINE = POSITION_MAJOR;
+  CheckTrain(deep, batch, features, local, active, summed);
+
+  DEEP_HEAD = 0;
+  AlignedFree(deep);
+
+#define CHECK_HIDDEN(size, ...) \
+  if (size != N_HIDDEN) CheckHidden(size, data, batch, features, local, active, summed);
+  HIDDEN_SIZES(CHECK_HIDDEN, )
+
+  printf("Checking kernel throughput against %s...\n", baselinePath);
+
+  CheckThroughput(baselinePath, "featurize", BenchFeaturize(data), "pos/s");
+  CheckThroughput(baselinePath, "predict", BenchPredict(nn, data), "pos/s");
+  CheckThroughput(baselinePath, "train", BenchTrain(nn, batch, local), "pos/s");
+
+  INPUT_ENGINE = FEATURE_MAJOR;
+  CheckThroughput(baselinePath, "train-feature-major", BenchTrain(nn, batch, local), "pos/s");
+  INPUT_ENGINE = POSITION_MAJOR;
+  CheckThroughput(baselinePath, "apply", BenchApplyGradients(nn, local, active), "batch/s");
+
+  printf("%s, %d failure(s)\n", failures ? "FAILED" : "PASSED", failures);
+
+  AlignedFree(nn);
+  AlignedFree(local);
+  AlignedFree(summed);
+  free(data->entries);
+  free(features);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,8 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include "types.h"
+
+int RunChecks(char* baselinePath);
+
+#endif
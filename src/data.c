@@ -1,16 +1,48 @@
+#define _GNU_SOURCE
+
 #include "data.h"
 
+#include <fcntl.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "board.h"
 #include "random.h"
 #include "util.h"
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#ifdef WIN32
+// No pread on windows, serialize the seek + read instead
+static pthread_mutex_t readLock = PTHREAD_MUTEX_INITIALIZER;
+
+static ssize_t pread(int fd, void* buf, size_t count, uint64_t offset) {
+  pthread_mutex_lock(&readLock);
+  _lseeki64(fd, offset, SEEK_SET);
+  ssize_t x = _read(fd, buf, count);
+  pthread_mutex_unlock(&readLock);
+
+  return x;
+}
+
+#define lseek _lseeki64
+#endif
+
 volatile int DATA_LOADED = 0;
 volatile int COMPLETE = 0;
+volatile float READ_BANDWIDTH = 0;
 
 void WriteToFile(char* dest, char* src, uint64_t entries) {
   FILE* fp = fopen(src, "r");
@@ -116,47 +148,427 @@ void LoadDataEntry(char* buffer, Board* result) {
   }
 }
 
-void ShuffleData(DataSet* data) {
+void ShuffleData(DataSet* data) { ShuffleEntries(data->entries, data->n); }
+
+void ShuffleEntries(Board* entries, uint64_t n) {
   Board temp;
 
-  for (uint32_t i = 0; i < data->n; i++) {
-    uint32_t j = RandomUInt64() % data->n;
-    temp = data->entries[i];
-    data->entries[i] = data->entries[j];
-    data->entries[j] = temp;
+  for (uint64_t i = 0; i < n; i++) {
+    uint64_t j = RandomUInt64() % n;
+    temp = entries[i];
+    entries[i] = entries[j];
+    entries[j] = temp;
   }
 }
 
-void* CyclicalLoader(void* args) {
-  CyclicalLoadArgs* loader = (CyclicalLoadArgs*)args;
+void OpenDataSource(DataSource* src, char* arg, uint64_t maxEntries, int direct) {
+  strcpy(src->path, arg);
+  src->weight = 1.0;
 
-  size_t readsize = BATCH_SIZE * BATCHES_PER_LOAD;
-  size_t location = 0;
+  // optional sampling weight, <path>,<weight>
+  char* comma = strrchr(src->path, ',');
+  if (comma) {
+    *comma = '\0';
+    src->weight = atof(comma + 1);
+  }
+
+  if (src->weight <= 0) printf("Invalid weight for data file: %s!\n", arg), exit(1);
+
+  src->fd = open(src->path, O_RDONLY | O_BINARY);
+  if (src->fd < 0) printf("Cannot open file: %s!\n", src->path), exit(1);
+
+  src->directFd = -1;
+#ifdef O_DIRECT
+  if (direct && (src->directFd = open(src->path, O_RDONLY | O_DIRECT)) < 0)
+    printf("Unable to open %s with O_DIRECT, using buffered reads.\n", src->path);
+#else
+  if (direct) printf("O_DIRECT is not supported on this platform, using buffered reads.\n");
+#endif
+
+  src->entriesCount = lseek(src->fd, 0, SEEK_END) / sizeof(Board);
+  if (src->entriesCount > maxEntries) src->entriesCount = maxEntries;
+
+  // keep every read of a direct source on an aligned boundary, even after wrapping
+  if (src->directFd >= 0) src->entriesCount -= src->entriesCount % (DIRECT_ALIGN / sizeof(Board));
+
+  if (!src->entriesCount) printf("No entries found in data file: %s!\n", src->path), exit(1);
+
+  src->location = 0;
+
+  src->nBlocks = 0;
+  src->blocks = NULL;
+}
+
+DataSource* PickSource(CyclicalLoadArgs* loader) {
+  float total = 0.0;
+  for (int i = 0; i < loader->nSources; i++) total += loader->sources[i].weight;
+
+  float r = total * (RandomUInt64() >> 11) * (1.0 / (1ULL << 53));
+  for (int i = 0; i < loader->nSources - 1; i++) {
+    if (r < loader->sources[i].weight) return &loader->sources[i];
+    r -= loader->sources[i].weight;
+  }
+
+  return &loader->sources[loader->nSources - 1];
+}
+
+// Queue a sequential read from a source after the queued requests, wrapping back to the start at the end
+// of the file. A source smaller than the read wraps more than once, so the requests grow as needed.
+int QueueSourceReads(DataSource* src, Board* dest, size_t n, ReadRequest** requests, int* capacity, int queued) {
+  while (n) {
+    if (queued == *capacity) {
+      *capacity *= 2;
+      *requests = realloc(*requests, sizeof(ReadRequest) * *capacity);
+    }
 
-  while (!COMPLETE) {
     // back to the start
-    if (location + readsize > loader->entriesCount) {
-      fseek(loader->fin, 0, SEEK_SET);
-      location = 0;
+    if (src->location >= src->entriesCount) src->location = 0;
+
+    size_t readsize = src->entriesCount - src->location;
+    if (readsize > n) readsize = n;
+
+    (*requests)[queued++] = (ReadRequest){.src = src, .offset = src->location, .n = readsize, .dest = dest};
+
+    src->location += readsize;
+    dest += readsize;
+    n -= readsize;
+  }
+
+  return queued;
+}
+
+typedef struct {
+  ReadRequest* chunks;
+  int n;
+  atomic_int next;
+} ReadQueue;
+
+static void ReadChunk(ReadRequest* chunk) {
+  DataSource* src = chunk->src;
+
+  char* dest = (char*)chunk->dest;
+  uint64_t offset = chunk->offset * sizeof(Board);
+  size_t remaining = chunk->n * sizeof(Board);
+
+  int fd = src->fd;
+  if (src->directFd >= 0 && !((uintptr_t)dest % DIRECT_ALIGN) && !(offset % DIRECT_ALIGN) &&
+      !(remaining % DIRECT_ALIGN))
+    fd = src->directFd;
+
+  while (remaining) {
+    ssize_t x = pread(fd, dest, remaining, offset);
+    if (x <= 0) printf("Failed to read entries from %s!\n", src->path), exit(1);
+
+    dest += x;
+    offset += x;
+    remaining -= x;
+  }
+}
+
+static void* Reader(void* args) {
+  ReadQueue* queue = (ReadQueue*)args;
+
+  int i;
+  while ((i = atomic_fetch_add(&queue->next, 1)) < queue->n) ReadChunk(&queue->chunks[i]);
+
+  return NULL;
+}
+
+void ReadParallel(ReadRequest* requests, int n, int readers) {
+  long start = GetTimeMS();
+
+  // split every request up into chunks that are spread across the readers
+  const uint64_t perChunk = READ_CHUNK / sizeof(Board);
+
+  int nChunks = 0;
+  for (int i = 0; i < n; i++) nChunks += (requests[i].n + perChunk - 1) / perChunk;
+
+  ReadQueue queue[1];
+  queue->chunks = malloc(sizeof(ReadRequest) * nChunks);
+  queue->n = 0;
+  atomic_init(&queue->next, 0);
+
+  uint64_t bytes = 0;
+  for (int i = 0; i < n; i++) {
+    bytes += requests[i].n * sizeof(Board);
+
+    for (uint64_t c = 0; c < requests[i].n; c += perChunk) {
+      ReadRequest* chunk = &queue->chunks[queue->n++];
+      *chunk = requests[i];
+
+      chunk->offset += c;
+      chunk->dest += c;
+      chunk->n = chunk->n - c < perChunk ? chunk->n - c : perChunk;
     }
+  }
 
-    size_t x;
-    if ((x = fread(loader->nextData->entries, sizeof(Board), readsize, loader->fin)) != readsize)
-      printf("Failed to read entries from file!\n"), exit(1);
+  if (readers > nChunks) readers = nChunks;
+  if (readers <= 1) {
+    Reader(queue);
+  } else {
+    pthread_t* threads = malloc(sizeof(pthread_t) * readers);
+
+    for (int i = 0; i < readers; i++) pthread_create(&threads[i], NULL, &Reader, queue);
+    for (int i = 0; i < readers; i++) pthread_join(threads[i], NULL);
+
+    free(threads);
+  }
+
+  free(queue->chunks);
+
+  long elapsed = GetTimeMS() - start;
+  READ_BANDWIDTH = bytes / (1024.0 * 1024.0) / (elapsed > 0 ? elapsed / 1000.0 : 0.001);
+}
+
+// Fill the load with blocks picked at random from across every source, a read shorter than its block
+// starts at a random position within it
+static int QueueBlockReads(CyclicalLoadArgs* loader, Board* dest, size_t n, ReadRequest** requests, int* capacity) {
+  int queued = 0;
+
+  while (n) {
+    if (queued == *capacity) {
+      *capacity *= 2;
+      *requests = realloc(*requests, sizeof(ReadRequest) * *capacity);
+    }
+
+    DataSource* src = PickSource(loader);
+    IndexBlock* block = &src->blocks[RandomUInt64() % src->nBlocks];
 
-    loader->nextData->n = readsize;
-    location += readsize;
+    size_t readsize = block->n < n ? block->n : n;
+    uint64_t start = block->offset / sizeof(Board) + RandomUInt64() % (block->n - readsize + 1);
+    (*requests)[queued++] = (ReadRequest){.src = src, .offset = start, .n = readsize, .dest = dest};
+
+    dest += readsize;
+    n -= readsize;
+  }
+
+  return queued;
+}
 
-    ShuffleData(loader->nextData);
+// fills dest with n positions, either in random index blocks or in batch sized sequential runs of a weighted source
+static void LoadFromSources(CyclicalLoadArgs* loader, Board* dest, size_t n, ReadRequest** requests, int* capacity) {
+  int queued = 0;
+
+  if (loader->blockSampling) {
+    queued = QueueBlockReads(loader, dest, n, requests, capacity);
+  } else {
+    const size_t batch = BATCH_SIZE;
+
+    for (size_t i = 0; i < n; i += batch) {
+      size_t readsize = n - i < batch ? n - i : batch;
+      queued = QueueSourceReads(PickSource(loader), &dest[i], readsize, requests, capacity, queued);
+    }
+  }
+
+  ReadParallel(*requests, queued, loader->readers);
+}
+
+// A comma separated list of eval=<cp>, pieces=<n>, nocheck and agree=<cp>, see Filter
+void ParseFilter(char* spec, Filter* filter) {
+  *filter = (Filter){.active = 1, .minEval = 0.0, .maxEval = 1.0, .winEval = 0.0, .lossEval = 1.0};
+
+  char buffer[128];
+  strncpy(buffer, spec, sizeof(buffer) - 1);
+  buffer[sizeof(buffer) - 1] = '\0';
+
+  for (char* term = strtok(buffer, ","); term; term = strtok(NULL, ",")) {
+    int value;
+
+    if (sscanf(term, "eval=%d", &value) == 1 && value > 0) {
+      filter->minEval = Sigmoid(-value);
+      filter->maxEval = Sigmoid(value);
+    } else if (sscanf(term, "pieces=%d", &value) == 1 && value > 0) {
+      filter->minPieces = value;
+    } else if (!strcmp(term, "nocheck")) {
+      filter->noCheck = 1;
+    } else if (sscanf(term, "agree=%d", &value) == 1 && value >= 0) {
+      filter->winEval = Sigmoid(-value);
+      filter->lossEval = Sigmoid(value);
+    } else {
+      printf("Invalid filter term: %s!\n", term);
+      exit(1);
+    }
+  }
+}
+
+// Drops the positions the filter rejects, moving the rest to the front, and returns how many are left.
+// The cheap predicates are a single branch free pass the compiler vectorizes, only what passes them is
+// looked at for checks.
+static size_t FilterEntries(Filter* filter, Board* entries, size_t n) {
+  uint8_t keep[FILTER_BLOCK];
+  size_t kept = 0;
+
+  for (size_t start = 0; start < n; start += FILTER_BLOCK) {
+    const size_t count = n - start < FILTER_BLOCK ? n - start : FILTER_BLOCK;
+    Board* block = &entries[start];
+
+    for (size_t i = 0; i < count; i++) {
+      const float eval = block[i].eval;
+      const int wdl = block[i].wdl;
+
+      keep[i] = (eval >= filter->minEval) & (eval <= filter->maxEval) &
+                (__builtin_popcountll(block[i].occupancies) >= filter->minPieces) &
+                !((wdl == 2) & (eval < filter->winEval)) & !((wdl == 0) & (eval > filter->lossEval));
+    }
+
+    if (filter->noCheck)
+      for (size_t i = 0; i < count; i++)
+        if (keep[i]) keep[i] = !InCheck(&block[i]);
+
+    for (size_t i = 0; i < count; i++) {
+      entries[kept] = block[i];
+      kept += keep[i];
+    }
+  }
+
+  filter->seen += n;
+  filter->kept += kept;
+
+  return kept;
+}
+
+// LoadFromSources through the filter. What it drops is refilled FILTER_BLOCK positions at a time through
+// scratch space, fresh reads each time, so a refill never sees the positions just rejected again.
+static void LoadFiltered(CyclicalLoadArgs* loader, Board* dest, size_t n, ReadRequest** requests, int* capacity) {
+  Filter* filter = &loader->filter;
+
+  LoadFromSources(loader, dest, n, requests, capacity);
+  if (!filter->active) return;
+
+  size_t filled = FilterEntries(filter, dest, n);
+  if (filled == n) return;
+
+  Board* scratch = malloc(sizeof(Board) * FILTER_BLOCK);
+  int empty = 0;
+
+  while (filled < n) {
+    LoadFromSources(loader, scratch, FILTER_BLOCK, requests, capacity);
+    size_t kept = FilterEntries(filter, scratch, FILTER_BLOCK);
+
+    if (kept) {
+      empty = 0;
+    } else if (++empty == FILTER_RETRIES) {
+      printf("The filter kept none of the last %d positions read, nothing is left to train on!\n",
+             FILTER_RETRIES * FILTER_BLOCK);
+      exit(1);
+    }
+
+    if (kept > n - filled) kept = n - filled;
+    memcpy(&dest[filled], scratch, sizeof(Board) * kept);
+    filled += kept;
+  }
+
+  free(scratch);
+}
+
+// A single load of data->n positions, read by the loader's readers through the filter and shuffled
+void LoadDataSet(CyclicalLoadArgs* loader, DataSet* data, ReadRequest** requests, int* capacity) {
+  LoadFiltered(loader, data->entries, data->n, requests, capacity);
+
+  if (loader->blockSampling) {
+    // random blocks already spread the load over the whole file, only mix them a few at a time
+    const size_t buffer = SHUFFLE_BLOCKS * INDEX_BLOCK;
+    for (size_t i = 0; i < data->n; i += buffer)
+      ShuffleEntries(&data->entries[i], data->n - i < buffer ? data->n - i : buffer);
+  } else {
+    ShuffleData(data);
+  }
+}
+
+void* CyclicalLoader(void* args) {
+  CyclicalLoadArgs* loader = (CyclicalLoadArgs*)args;
+
+  int capacity = 2 * BATCHES_PER_LOAD;
+  ReadRequest* requests = malloc(sizeof(ReadRequest) * capacity);
+
+  while (!COMPLETE) {
+    loader->nextData->n = BATCH_SIZE * BATCHES_PER_LOAD;
+    LoadDataSet(loader, loader->nextData, &requests, &capacity);
 
     DATA_LOADED = 1;
     while (DATA_LOADED)
       ;
   }
 
+  free(requests);
+
   return NULL;
 }
 
+void FillReservoir(CyclicalLoadArgs* loader) {
+  Reservoir* reservoir = loader->reservoir;
+
+  int capacity = 64;
+  ReadRequest* requests = malloc(sizeof(ReadRequest) * capacity);
+
+  LoadFiltered(loader, reservoir->entries, reservoir->size, &requests, &capacity);
+  LoadFiltered(loader, reservoir->staging[0], reservoir->stagingSize, &requests, &capacity);
+
+  reservoir->ready[0] = 1;
+  reservoir->ready[1] = 0;
+  reservoir->current = 0;
+  reservoir->cursor = 0;
+  reservoir->seed = RandomUInt64();
+  reservoir->waited = 0;
+
+  free(requests);
+}
+
+void* ReservoirLoader(void* args) {
+  CyclicalLoadArgs* loader = (CyclicalLoadArgs*)args;
+  Reservoir* reservoir = loader->reservoir;
+
+  int capacity = 64;
+  ReadRequest* requests = malloc(sizeof(ReadRequest) * capacity);
+
+  // the reservoir is filled up front, this only ever refills the staging buffer not being drained
+  int next = 1;
+  while (!COMPLETE) {
+    while (reservoir->ready[next])
+      ;
+
+    LoadFiltered(loader, reservoir->staging[next], reservoir->stagingSize, &requests, &capacity);
+
+    reservoir->ready[next] = 1;
+    next ^= 1;
+  }
+
+  free(requests);
+
+  return NULL;
+}
+
+// splitmix64, kept separate from the loader thread's generator
+INLINE uint64_t ReservoirRandom(Reservoir* reservoir) {
+  uint64_t z = (reservoir->seed += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+void DrawBatch(Reservoir* reservoir, DataSet* batch, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (reservoir->cursor == reservoir->stagingSize) {
+      reservoir->ready[reservoir->current] = 0;
+      reservoir->current ^= 1;
+      reservoir->cursor = 0;
+
+      if (!reservoir->ready[reservoir->current]) {
+        long start = GetTimeMS();
+        while (!reservoir->ready[reservoir->current])
+          ;
+        reservoir->waited += GetTimeMS() - start;
+      }
+    }
+
+    uint64_t slot = ReservoirRandom(reservoir) % reservoir->size;
+    batch->entries[i] = reservoir->entries[slot];
+    reservoir->entries[slot] = reservoir->staging[reservoir->current][reservoir->cursor++];
+  }
+
+  batch->n = n;
+}
+
 static char* RandomString(char* str, size_t size) {
   const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
   if (size) {
@@ -8,7 +8,17 @@ void LoadEntriesBinary(char* path, DataSet* data, uint64_t n, uint64_t offset);
 void LoadEntries(char* path, DataSet* data, uint32_t n, uint32_t offset);
 void LoadDataEntry(char* buffer, Board* result);
 void ShuffleData(DataSet* data);
+void ShuffleEntries(Board* entries, uint64_t n);
+void OpenDataSource(DataSource* src, char* arg, uint64_t maxEntries, int direct);
+DataSource* PickSource(CyclicalLoadArgs* loader);
+int QueueSourceReads(DataSource* src, Board* dest, size_t n, ReadRequest** requests, int* capacity, int queued);
+void ReadParallel(ReadRequest* requests, int n, int readers);
+void ParseFilter(char* spec, Filter* filter);
+void LoadDataSet(CyclicalLoadArgs* loader, DataSet* data, ReadRequest** requests, int* capacity);
 void* CyclicalLoader(void* args);
+void FillReservoir(CyclicalLoadArgs* loader);
+void* ReservoirLoader(void* args);
+void DrawBatch(Reservoir* reservoir, DataSet* batch, size_t n);
 void ShuffleBinpack(uint64_t n, char* in, char* out);
 
 #endif
\ No newline at end of file
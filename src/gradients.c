@@ -0,0 +1,146 @@
+#include "gradients.h"
+
+#include <string.h>
+
+INLINE void ApplyInputWeightsSized(int start, int end, int thread, void* arg, const int hidden) {
+  (void)thread;
+  ApplyCtx* ctx = arg;
+
+  for (int i = start; i < end; i++) {
+    if (!ctx->active[i]) continue;
+
+    int age = ctx->iteration - ctx->lastSeen[i];
+    ctx->lastSeen[i] = ctx->iteration;
+
+    for (int j = 0; j < hidden; j++) {
+      int idx = i * hidden + j;
+
+      float g = 0.0;
+      for (int t = 0; t < THREADS; t++) g += ctx->local[t].inputWeights[idx];
+
+      UpdateAndApplyGradientWithAge(&ctx->nn->inputWeights[idx], &ctx->grads->inputWeights[idx], g, age, ctx->alpha);
+    }
+
+    // only active rows are ever written by Train
+    if (ctx->consume)
+      for (int t = 0; t < THREADS; t++) memset(&ctx->local[t].inputWeights[i * hidden], 0, sizeof(float) * hidden);
+  }
+}
+
+SIZED_KERNEL(ApplyInputWeights, (int start, int end, int thread, void* arg), (start, end, thread, arg))
+
+static void ApplyInputBiasesTask(int start, int end, int thread, void* arg) {
+  (void)thread;
+  ApplyCtx* ctx = arg;
+
+  for (int i = start; i < end; i++) {
+    float g = 0.0;
+    for (int t = 0; t < THREADS; t++) g += ctx->local[t].inputBiases[i];
+
+    UpdateAndApplyGradient(&ctx->nn->inputBiases[i], &ctx->grads->inputBiases[i], g, ctx->alpha);
+  }
+
+  if (ctx->consume)
+    for (int t = 0; t < THREADS; t++) memset(&ctx->local[t].inputBiases[start], 0, sizeof(float) * (end - start));
+}
+
+static void ApplyOutputWeightsTask(int start, int end, int thread, void* arg) {
+  (void)thread;
+  ApplyCtx* ctx = arg;
+
+  for (int i = start; i < end; i++) {
+    float g = 0.0;
+    for (int t = 0; t < THREADS; t++) g += ctx->local[t].outputWeights[i];
+
+    UpdateAndApplyGradient(&ctx->nn->outputWeights[i], &ctx->grads->outputWeights[i], g, ctx->alpha);
+  }
+
+  if (ctx->consume)
+    for (int t = 0; t < THREADS; t++) memset(&ctx->local[t].outputWeights[start], 0, sizeof(float) * (end - start));
+}
+
+static void ApplyHeadTask(int start, int end, int thread, void* arg) {
+  (void)thread;
+  HeadCtx* ctx = arg;
+  ApplyCtx* apply = ctx->apply;
+
+  for (int i = start; i < end; i++) {
+    float g = 0.0;
+    for (int t = 0; t < THREADS; t++) g += ((float*)((char*)&apply->local[t] + ctx->offset))[i];
+
+    UpdateAndApplyGradient(&ctx->weights[i], &ctx->grads[i], g, apply->alpha);
+  }
+
+  if (apply->consume)
+    for (int t = 0; t < THREADS; t++)
+      memset((float*)((char*)&apply->local[t] + ctx->offset) + start, 0, sizeof(float) * (end - start));
+}
+
+// With consume, the step clears what it sums of local, leaving it ready for the next Train without
+// a pass of its own over the buffers
+void PrepareApply(ApplyStep* step, NN* nn, NNGradients* grads, BatchGradients* local, uint8_t* active, int consume) {
+  step->ctx = (ApplyCtx){.nn = nn,
+                         .grads = grads,
+                         .local = local,
+                         .active = active,
+                         .alpha = ALPHA,
+                         .lastSeen = LAST_SEEN,
+                         .iteration = ITERATION,
+                         .consume = consume};
+
+  ApplyCtx* ctx = &step->ctx;
+
+  step->head[0] = (HeadCtx){ctx, nn->l2Weights, grads->l2Weights, offsetof(BatchGradients, l2Weights)};
+  step->head[1] = (HeadCtx){ctx, nn->l2Biases, grads->l2Biases, offsetof(BatchGradients, l2Biases)};
+  step->head[2] = (HeadCtx){ctx, nn->l3Weights, grads->l3Weights, offsetof(BatchGradients, l3Weights)};
+  step->head[3] = (HeadCtx){ctx, nn->l3Biases, grads->l3Biases, offsetof(BatchGradients, l3Biases)};
+
+  // inactive rows are nearly free, so keep the row chunks small for stealing
+  // the deep head's output layer is only the first N_L3 output weights
+  TaskGroup groups[APPLY_GROUPS] = {
+      {.fn = ApplyInputWeightsKernels[HIDDEN_KERNEL], .ctx = ctx, .n = N_INPUT, .chunk = 8},
+      {.fn = ApplyInputBiasesTask, .ctx = ctx, .n = N_HIDDEN, .chunk = 64},
+      {.fn = ApplyOutputWeightsTask, .ctx = ctx, .n = DEEP_HEAD ? N_L3 : N_L1, .chunk = 64},
+      {.fn = ApplyHeadTask, .ctx = &step->head[0], .n = N_L2 * N_L1, .chunk = 1024},
+      {.fn = ApplyHeadTask, .ctx = &step->head[1], .n = N_L2, .chunk = N_L2},
+      {.fn = ApplyHeadTask, .ctx = &step->head[2], .n = N_L3 * N_L2, .chunk = N_L3 * N_L2},
+      {.fn = ApplyHeadTask, .ctx = &step->head[3], .n = N_L3, .chunk = N_L3},
+  };
+
+  memcpy(step->groups, groups, sizeof(groups));
+  step->nGroups = DEEP_HEAD ? 7 : 3;
+}
+
+// The output bias, once the groups have run
+void FinishApply(ApplyStep* step) {
+  ApplyCtx* ctx = &step->ctx;
+
+  float g = 0.0;
+  for (int t = 0; t < THREADS; t++) g += ctx->local[t].outputBias;
+
+  UpdateAndApplyGradient(&ctx->nn->outputBias, &ctx->grads->outputBias, g, ctx->alpha);
+
+  if (ctx->consume)
+    for (int t = 0; t < THREADS; t++) ctx->local[t].outputBias = 0;
+}
+
+void ApplyGradients(NN* nn, NNGradients* grads, BatchGradients* local, uint8_t* active) {
+  ApplyStep step[1];
+
+  PrepareApply(step, nn, grads, local, active, 0);
+  PoolRun(step->groups, step->nGroups);
+  FinishApply(step);
+}
+
+void ClearGradients(NNGradients* gradients) {
+  memset(gradients->inputWeights, 0, sizeof(gradients->inputWeights));
+  memset(gradients->inputBiases, 0, sizeof(gradients->inputBiases));
+
+  memset(gradients->outputWeights, 0, sizeof(gradients->outputWeights));
+  memset(&gradients->outputBias, 0, sizeof(gradients->outputBias));
+
+  memset(gradients->l2Weights, 0, sizeof(gradients->l2Weights));
+  memset(gradients->l2Biases, 0, sizeof(gradients->l2Biases));
+  memset(gradients->l3Weights, 0, sizeof(gradients->l3Weights));
+  memset(gradients->l3Biases, 0, sizeof(gradients->l3Biases));
+}
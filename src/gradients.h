@@ -1,71 +1,60 @@
 #ifndef GRADIENTS_H
 #define GRADIENTS_H
 
-#include <string.h>
+#include <stddef.h>
 
+#include "pool.h"
 #include "types.h"
 #include "util.h"
 
-void UpdateAndApplyGradientWithAge(float* v, Gradient* grad, float g, int age) {
+INLINE void UpdateAndApplyGradientWithAge(float* v, Gradient* grad, float g, int age, float alpha) {
   grad->M = powf(BETA1, age) * grad->M + (1.0 - BETA1) * g;
   grad->V = powf(BETA2, age) * grad->V + (1.0 - BETA2) * g * g;
 
-  *v -= ALPHA * grad->M / (sqrtf(grad->V) + EPSILON);
+  *v -= alpha * grad->M / (sqrtf(grad->V) + EPSILON);
 }
 
-void UpdateAndApplyGradient(float* v, Gradient* grad, float g) {
+INLINE void UpdateAndApplyGradient(float* v, Gradient* grad, float g, float alpha) {
   grad->M = BETA1 * grad->M + (1.0 - BETA1) * g;
   grad->V = BETA2 * grad->V + (1.0 - BETA2) * g * g;
 
-  *v -= ALPHA * grad->M / (sqrtf(grad->V) + EPSILON);
+  *v -= alpha * grad->M / (sqrtf(grad->V) + EPSILON);
 }
 
-void ApplyGradients(NN* nn, NNGradients* grads, BatchGradients* local, uint8_t* active) {
-#pragma omp parallel for schedule(static) num_threads(THREADS)
-  for (int i = 0; i < N_INPUT; i++) {
-    if (!active[i]) continue;
-
-    int age = ITERATION - LAST_SEEN[i];
-    LAST_SEEN[i] = ITERATION;
-
-    for (int j = 0; j < N_HIDDEN; j++) {
-      int idx = i * N_HIDDEN + j;
-
-      float g = 0.0;
-      for (int t = 0; t < THREADS; t++) g += local[t].inputWeights[idx];
-
-      UpdateAndApplyGradientWithAge(&nn->inputWeights[idx], &grads->inputWeights[idx], g, age);
-    }
-  }
-
-#pragma omp parallel for schedule(static) num_threads(THREADS)
-  for (int i = 0; i < N_HIDDEN; i++) {
-    float g = 0.0;
-    for (int t = 0; t < THREADS; t++) g += local[t].inputBiases[i];
-
-    UpdateAndApplyGradient(&nn->inputBiases[i], &grads->inputBiases[i], g);
-  }
-
-#pragma omp parallel for schedule(static) num_threads(THREADS)
-  for (int i = 0; i < N_L1; i++) {
-    float g = 0.0;
-    for (int t = 0; t < THREADS; t++) g += local[t].outputWeights[i];
-
-    UpdateAndApplyGradient(&nn->outputWeights[i], &grads->outputWeights[i], g);
-  }
-
-  float g = 0.0;
-  for (int t = 0; t < THREADS; t++) g += local[t].outputBias;
-
-  UpdateAndApplyGradient(&nn->outputBias, &grads->outputBias, g);
-}
-
-void ClearGradients(NNGradients* gradients) {
-  memset(gradients->inputWeights, 0, sizeof(gradients->inputWeights));
-  memset(gradients->inputBiases, 0, sizeof(gradients->inputBiases));
-
-  memset(gradients->outputWeights, 0, sizeof(gradients->outputWeights));
-  memset(&gradients->outputBias, 0, sizeof(gradients->outputBias));
-}
-
-#endif
\ No newline at end of file
+// The model's learning rate, lazy Adam ages and iteration are taken when the step is prepared, as
+// another model may be selected by the time it runs
+typedef struct {
+  NN* nn;
+  NNGradients* grads;
+  BatchGradients* local;
+  uint8_t* active;
+  float alpha;
+  int* lastSeen;
+  int iteration;
+  int consume;  // clear the gradients of local once they are summed
+} ApplyCtx;
+
+typedef struct {
+  ApplyCtx* apply;
+  float* weights;
+  Gradient* grads;
+  size_t offset;  // of the matching float array within BatchGradients
+} HeadCtx;
+
+#define APPLY_GROUPS 7
+
+// An optimizer step, run as its groups in a PoolRun of its own or beside other work, then finished off.
+// The groups point back into the step, so it stays put until it is finished.
+typedef struct {
+  ApplyCtx ctx;
+  HeadCtx head[4];
+  TaskGroup groups[APPLY_GROUPS];
+  int nGroups;
+} ApplyStep;
+
+void PrepareApply(ApplyStep* step, NN* nn, NNGradients* grads, BatchGradients* local, uint8_t* active, int consume);
+void FinishApply(ApplyStep* step);
+void ApplyGradients(NN* nn, NNGradients* grads, BatchGradients* local, uint8_t* active);
+void ClearGradients(NNGradients* gradients);
+
+#endif
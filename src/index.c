@@ -0,0 +1,123 @@
+#include "index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#ifdef WIN32
+#include <io.h>
+#define lseek _lseeki64
+#else
+#include <unistd.h>
+#endif
+
+#include "data.h"
+
+const uint32_t INDEX_MAGIC = 'B' | 'I' << 8 | 'D' << 16 | 'X' << 24;
+
+int ValidBoard(Board* board) {
+  return board->stm <= BLACK && board->wdl <= 2 && board->kings[WHITE] < 64 && board->kings[BLACK] < 64 &&
+         (board->occupancies >> board->kings[WHITE] & 1) && (board->occupancies >> board->kings[BLACK] & 1) &&
+         __builtin_popcountll(board->occupancies) <= 32 && board->eval >= 0.0 && board->eval <= 1.0;
+}
+
+// A single pass over the file, recording where each block starts and how many records it holds.
+// Records are fixed size today, the block sizes are stored so that variable sized ones can follow.
+void BuildIndex(DataSource* src, char* indexPath) {
+  printf("Building index of %s\n", src->path);
+
+  uint64_t fileSize = lseek(src->fd, 0, SEEK_END);
+  uint64_t total = fileSize / sizeof(Board);
+
+  IndexHeader header = {.magic = INDEX_MAGIC,
+                        .version = INDEX_VERSION,
+                        .recordSize = sizeof(Board),
+                        .blockSize = INDEX_BLOCK,
+                        .fileSize = fileSize,
+                        .nBlocks = (total + INDEX_BLOCK - 1) / INDEX_BLOCK};
+
+  IndexBlock* blocks = malloc(sizeof(IndexBlock) * header.nBlocks);
+  Board* buffer = malloc(sizeof(Board) * INDEX_BLOCK);
+
+  uint64_t invalid = 0;
+
+  for (uint64_t b = 0; b < header.nBlocks; b++) {
+    uint64_t n = total - b * INDEX_BLOCK < INDEX_BLOCK ? total - b * INDEX_BLOCK : INDEX_BLOCK;
+
+    blocks[b] = (IndexBlock){.offset = b * INDEX_BLOCK * sizeof(Board), .n = n, .bytes = n * sizeof(Board)};
+
+    ReadRequest request = {.src = src, .offset = b * INDEX_BLOCK, .n = n, .dest = buffer};
+    ReadParallel(&request, 1, 1);
+
+    for (uint64_t i = 0; i < n; i++) invalid += !ValidBoard(&buffer[i]);
+
+    if (!(b % 64)) printf("\rIndexed blocks: [%10" PRIu64 " of %10" PRIu64 "]", b + 1, header.nBlocks);
+  }
+
+  printf("\rIndexed blocks: [%10" PRIu64 " of %10" PRIu64 "]\n", header.nBlocks, header.nBlocks);
+  if (invalid) printf("Found %" PRIu64 " malformed positions in %s!\n", invalid, src->path);
+
+  FILE* fout = fopen(indexPath, "wb");
+  if (fout == NULL) {
+    printf("Unable to write index to %s, it will be rebuilt next run.\n", indexPath);
+  } else {
+    fwrite(&header, sizeof(IndexHeader), 1, fout);
+    fwrite(blocks, sizeof(IndexBlock), header.nBlocks, fout);
+    fclose(fout);
+  }
+
+  src->nBlocks = header.nBlocks;
+  src->blocks = blocks;
+
+  free(buffer);
+}
+
+int LoadIndex(DataSource* src, char* indexPath) {
+  FILE* fin = fopen(indexPath, "rb");
+  if (fin == NULL) return 0;
+
+  IndexHeader header;
+  if (fread(&header, sizeof(IndexHeader), 1, fin) != 1 || header.magic != INDEX_MAGIC ||
+      header.version != INDEX_VERSION || header.recordSize != sizeof(Board) ||
+      header.fileSize != (uint64_t)lseek(src->fd, 0, SEEK_END)) {
+    printf("Index %s is stale, rebuilding.\n", indexPath);
+    fclose(fin);
+    return 0;
+  }
+
+  src->nBlocks = header.nBlocks;
+  src->blocks = malloc(sizeof(IndexBlock) * header.nBlocks);
+
+  if (fread(src->blocks, sizeof(IndexBlock), header.nBlocks, fin) != header.nBlocks) {
+    printf("Index %s is truncated, rebuilding.\n", indexPath);
+    free(src->blocks);
+    fclose(fin);
+    return 0;
+  }
+
+  fclose(fin);
+  return 1;
+}
+
+// Load (or build) the sidecar index at <path>.idx, limited to the entries in use from the source
+void OpenIndex(DataSource* src) {
+  char indexPath[136];
+  sprintf(indexPath, "%s.idx", src->path);
+
+  if (!LoadIndex(src, indexPath)) BuildIndex(src, indexPath);
+
+  uint64_t kept = 0, entries = 0;
+  while (kept < src->nBlocks && entries < src->entriesCount) {
+    IndexBlock* block = &src->blocks[kept++];
+
+    if (entries + block->n > src->entriesCount) {
+      block->n = src->entriesCount - entries;
+      block->bytes = block->n * sizeof(Board);
+    }
+
+    entries += block->n;
+  }
+
+  src->nBlocks = kept;
+}
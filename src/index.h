@@ -0,0 +1,11 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "types.h"
+
+int ValidBoard(Board* board);
+void BuildIndex(DataSource* src, char* indexPath);
+int LoadIndex(DataSource* src, char* indexPath);
+void OpenIndex(DataSource* src);
+
+#endif
@@ -0,0 +1,74 @@
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+const uint32_t METRICS_MAGIC = 'B' | 'R' << 8 | 'K' << 16 | 'M' << 24;
+
+#ifdef WIN32
+Metrics* OpenMetrics(char* path) {
+  printf("Live metrics are not supported on windows, %s will not be written.\n", path);
+  return NULL;
+}
+
+uint64_t ResidentBytes() { return 0; }
+#else
+// Maps path as the run's metrics block, NULL (and no metrics) when it cannot be created
+Metrics* OpenMetrics(char* path) {
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, sizeof(Metrics))) {
+    printf("Unable to create metrics at %s, continuing without them.\n", path);
+    if (fd >= 0) close(fd);
+    return NULL;
+  }
+
+  Metrics* metrics = mmap(NULL, sizeof(Metrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (metrics == MAP_FAILED) {
+    printf("Unable to map metrics at %s, continuing without them.\n", path);
+    return NULL;
+  }
+
+  metrics->version = METRICS_VERSION;
+  __atomic_store_n(&metrics->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+
+  return metrics;
+}
+
+uint64_t ResidentBytes() {
+  FILE* fp = fopen("/proc/self/statm", "r");
+  if (fp == NULL) return 0;
+
+  uint64_t size, resident = 0;
+  if (fscanf(fp, "%" SCNu64 " %" SCNu64, &size, &resident) != 2) resident = 0;
+  fclose(fp);
+
+  return resident * sysconf(_SC_PAGESIZE);
+}
+#endif
+
+// Copies every field after the sequence over, a word at a time, inside the sequence's odd window
+void PublishMetrics(Metrics* metrics, Metrics* update) {
+  if (metrics == NULL) return;
+
+  uint64_t* dest = (uint64_t*)metrics;
+  uint64_t sequence = metrics->sequence;
+  __atomic_store_n(&metrics->sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  for (size_t i = offsetof(Metrics, updated) / sizeof(uint64_t); i < sizeof(Metrics) / sizeof(uint64_t); i++) {
+    uint64_t word;
+    memcpy(&word, (char*)update + i * sizeof(uint64_t), sizeof(uint64_t));
+    __atomic_store_n(&dest[i], word, __ATOMIC_RELAXED);
+  }
+
+  __atomic_store_n(&metrics->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
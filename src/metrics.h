@@ -0,0 +1,10 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "types.h"
+
+Metrics* OpenMetrics(char* path);
+void PublishMetrics(Metrics* metrics, Metrics* update);
+uint64_t ResidentBytes();
+
+#endif
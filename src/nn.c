@@ -9,34 +9,129 @@
 
 #include "bits.h"
 #include "board.h"
+#include "pool.h"
 #include "random.h"
 #include "util.h"
 
 const int NETWORK_MAGIC = 'B' | 'R' << 8 | 'K' << 16 | 'R' << 24;
+const int DEEP_NETWORK_MAGIC = 'B' | 'R' << 8 | 'K' << 16 | 'D' << 24;
+// Any other hidden size, the magic is followed by the hidden size and whether the head is deep
+const int SIZED_NETWORK_MAGIC = 'B' | 'R' << 8 | 'K' << 16 | 'S' << 24;
+
+#define SIZE_ENTRY(size, ...) size,
+static const int HIDDEN[] = {HIDDEN_SIZES(SIZE_ENTRY, )};
+
+// Switches every sized kernel over to hidden, which must be one of HIDDEN_SIZES
+void SetHidden(int hidden) {
+  for (size_t i = 0; i < sizeof(HIDDEN) / sizeof(int); i++) {
+    if (HIDDEN[i] != hidden) continue;
+
+    N_HIDDEN = hidden;
+    HIDDEN_KERNEL = i;
+    return;
+  }
+
+  printf("Unsupported hidden size %d, supported are:", hidden);
+  for (size_t i = 0; i < sizeof(HIDDEN) / sizeof(int); i++) printf(" %d", HIDDEN[i]);
+  printf("\n");
+  exit(1);
+}
 
 void NNPredict(NN* nn, Features* f, Color stm, NetworkTrace* trace) {
-  trace->output = nn->outputBias;
+  HeadTrace head[1];
+
+  NNAccumulate(nn, f, stm, trace->accumulator);
+  HeadForward(nn, trace->accumulator, 1, head, &trace->output);
+}
+
+// Raw outputs of a block of post ReLU accumulators (n rows of N_L1)
+void HeadForward(NN* nn, float* accumulators, const int n, HeadTrace* head, float* raw) {
+  if (!DEEP_HEAD) {
+    BlockDotProduct(accumulators, n, nn->outputWeights, N_L1, nn->outputBias, raw);
+    return;
+  }
+
+  DenseForward(accumulators, N_L1, n, nn->l2Weights, nn->l2Biases, N_L2, head->l2[0]);
+  ReLU(head->l2[0], n * N_L2);
+
+  DenseForward(head->l2[0], N_L2, n, nn->l3Weights, nn->l3Biases, N_L3, head->l3[0]);
+  ReLU(head->l3[0], n * N_L3);
+
+  BlockDotProduct(head->l3[0], n, nn->outputWeights, N_L3, nn->outputBias, raw);
+}
+
+// From the loss gradient of each raw output, adds the head's gradients to local and writes the
+// gradient of each accumulator (before its ReLU mask) to inputLosses
+void HeadBackward(NN* nn, float* accumulators, const int n, HeadTrace* head, float* outputLosses,
+                  BatchGradients* local, float* inputLosses) {
+  for (int k = 0; k < n; k++) local->outputBias += outputLosses[k];
+
+  if (!DEEP_HEAD) {
+    BlockAxpy(local->outputWeights, accumulators, n, outputLosses, N_L1);
+
+    for (int k = 0; k < n; k++)
+      for (int i = 0; i < N_L1; i++) inputLosses[k * N_L1 + i] = outputLosses[k] * nn->outputWeights[i];
 
-  // Apply first layer
-  float* stmAccumulator = trace->accumulator;
-  float* xstmAccumulator = &trace->accumulator[N_HIDDEN];
+    return;
+  }
+
+  float l3Losses[OUTPUT_BLOCK][N_L3] ALIGN64;
+  float l2Losses[OUTPUT_BLOCK][N_L2] ALIGN64;
+
+  BlockAxpy(local->outputWeights, head->l3[0], n, outputLosses, N_L3);
+
+  for (int k = 0; k < n; k++)
+    for (int i = 0; i < N_L3; i++)
+      l3Losses[k][i] = outputLosses[k] * nn->outputWeights[i] * ReLUPrime(head->l3[k][i]);
+
+  DenseBackward(head->l2[0], N_L2, n, l3Losses[0], N_L3, nn->l3Weights, local->l3Weights, local->l3Biases,
+                l2Losses[0]);
+
+  for (int k = 0; k < n; k++)
+    for (int i = 0; i < N_L2; i++) l2Losses[k][i] *= ReLUPrime(head->l2[k][i]);
+
+  DenseBackward(accumulators, N_L1, n, l2Losses[0], N_L2, nn->l2Weights, local->l2Weights, local->l2Biases,
+                inputLosses);
+}
+
+INLINE void AccumulateSized(NN* nn, Feature (*features)[2], int n, Color stm, float* accumulator, const int hidden) {
+  float* stmAccumulator = accumulator;
+  float* xstmAccumulator = &accumulator[hidden];
 
-  memcpy(stmAccumulator, nn->inputBiases, sizeof(float) * N_HIDDEN);
-  memcpy(xstmAccumulator, nn->inputBiases, sizeof(float) * N_HIDDEN);
+  memcpy(stmAccumulator, nn->inputBiases, sizeof(float) * hidden);
+  memcpy(xstmAccumulator, nn->inputBiases, sizeof(float) * hidden);
 
-  for (int i = 0; i < f->n; i++) {
-    for (size_t j = 0; j < N_HIDDEN; j++) {
-      stmAccumulator[j] += nn->inputWeights[f->features[i][stm] * N_HIDDEN + j];
-      xstmAccumulator[j] += nn->inputWeights[f->features[i][stm ^ 1] * N_HIDDEN + j];
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < hidden; j++) {
+      stmAccumulator[j] += nn->inputWeights[features[i][stm] * hidden + j];
+      xstmAccumulator[j] += nn->inputWeights[features[i][stm ^ 1] * hidden + j];
     }
   }
 
-  ReLU(trace->accumulator, N_L1);
+  Activate(accumulator, 2 * hidden);
+}
+
+SIZED_KERNEL(Accumulate, (NN * nn, Feature(*features)[2], int n, Color stm, float* accumulator),
+             (nn, features, n, stm, accumulator))
 
-  trace->output += DotProduct(trace->accumulator, nn->outputWeights, N_L1);
+// First layer only, the post ReLU accumulator of both perspectives (stm first)
+void NNAccumulate(NN* nn, Features* f, Color stm, float* accumulator) {
+  NNAccumulateIndices(nn, f->features, f->n, stm, accumulator);
+}
+
+// As above, straight from n (white, black) feature pairs
+void NNAccumulateIndices(NN* nn, Feature (*features)[2], int n, Color stm, float* accumulator) {
+  AccumulateKernels[HIDDEN_KERNEL](nn, features, n, stm, accumulator);
 }
 
 NN* LoadNN(char* path) {
+  NN* nn = AlignedMalloc(sizeof(NN));
+  ReadNN(nn, path);
+
+  return nn;
+}
+
+void ReadNN(NN* nn, char* path) {
   FILE* fp = fopen(path, "rb");
   if (fp == NULL) {
     printf("Unable to read network at %s!\n", path);
@@ -46,30 +141,55 @@ NN* LoadNN(char* path) {
   int magic;
   fread(&magic, 4, 1, fp);
 
-  if (magic != NETWORK_MAGIC) {
+  if (magic != NETWORK_MAGIC && magic != DEEP_NETWORK_MAGIC && magic != SIZED_NETWORK_MAGIC) {
     printf("Magic header does not match!\n");
     exit(1);
   }
 
+  // the file decides the architecture
+  int hidden = 512;
+  DEEP_HEAD = magic == DEEP_NETWORK_MAGIC;
+
+  if (magic == SIZED_NETWORK_MAGIC) {
+    fread(&hidden, sizeof(int), 1, fp);
+    fread(&DEEP_HEAD, sizeof(int), 1, fp);
+  }
+
+  SetHidden(hidden);
+
   uint64_t hash;
   fread(&hash, sizeof(uint64_t), 1, fp);
   printf("Reading network with hash %llx\n", hash);
 
-  NN* nn = AlignedMalloc(sizeof(NN));
-
   fread(nn->inputWeights, sizeof(float), N_INPUT * N_HIDDEN, fp);
   fread(nn->inputBiases, sizeof(float), N_HIDDEN, fp);
-  fread(nn->outputWeights, sizeof(float), N_L1, fp);
+
+  if (DEEP_HEAD) {
+    memset(nn->outputWeights, 0, sizeof(nn->outputWeights));
+
+    fread(nn->l2Weights, sizeof(float), N_L2 * N_L1, fp);
+    fread(nn->l2Biases, sizeof(float), N_L2, fp);
+    fread(nn->l3Weights, sizeof(float), N_L3 * N_L2, fp);
+    fread(nn->l3Biases, sizeof(float), N_L3, fp);
+    fread(nn->outputWeights, sizeof(float), N_L3, fp);
+  } else {
+    fread(nn->outputWeights, sizeof(float), N_L1, fp);
+  }
+
   fread(&nn->outputBias, sizeof(float), N_OUTPUT, fp);
 
   fclose(fp);
+}
+
+NN* LoadRandomNN() {
+  NN* nn = AlignedMalloc(sizeof(NN));
+  RandomizeNN(nn);
 
   return nn;
 }
 
-NN* LoadRandomNN() {
+void RandomizeNN(NN* nn) {
   srand(time(NULL));
-  NN* nn = AlignedMalloc(sizeof(NN));
 
   for (int i = 0; i < N_INPUT * N_HIDDEN; i++) nn->inputWeights[i] = RandomGaussian(0, sqrt(1.0 / 32));
 
@@ -77,9 +197,16 @@ NN* LoadRandomNN() {
 
   for (int i = 0; i < N_L1; i++) nn->outputWeights[i] = RandomGaussian(0, sqrt(1.0 / N_HIDDEN));
 
-  nn->outputBias = 0;
+  // He initialized, only the head's last layer feeds the output
+  for (int i = 0; i < N_L2 * N_L1; i++) nn->l2Weights[i] = RandomGaussian(0, sqrt(2.0 / N_L1));
+  for (int i = 0; i < N_L3 * N_L2; i++) nn->l3Weights[i] = RandomGaussian(0, sqrt(2.0 / N_L2));
+  for (int i = 0; i < N_L2; i++) nn->l2Biases[i] = 0;
+  for (int i = 0; i < N_L3; i++) nn->l3Biases[i] = 0;
 
-  return nn;
+  if (DEEP_HEAD)
+    for (int i = 0; i < N_L1; i++) nn->outputWeights[i] = i < N_L3 ? RandomGaussian(0, sqrt(1.0 / N_L3)) : 0;
+
+  nn->outputBias = 0;
 }
 
 void SaveNN(NN* nn, char* path) {
@@ -89,15 +216,69 @@ void SaveNN(NN* nn, char* path) {
     return;
   }
 
-  fwrite(&NETWORK_MAGIC, sizeof(int), 1, fp);
+  // the original 512 formats are kept as they were, for the engine
+  if (N_HIDDEN != 512) {
+    fwrite(&SIZED_NETWORK_MAGIC, sizeof(int), 1, fp);
+    fwrite(&N_HIDDEN, sizeof(int), 1, fp);
+    fwrite(&DEEP_HEAD, sizeof(int), 1, fp);
+  } else {
+    fwrite(DEEP_HEAD ? &DEEP_NETWORK_MAGIC : &NETWORK_MAGIC, sizeof(int), 1, fp);
+  }
 
   uint64_t hash = NetworkHash(nn);
   fwrite(&hash, sizeof(uint64_t), 1, fp);
 
   fwrite(nn->inputWeights, sizeof(float), N_INPUT * N_HIDDEN, fp);
   fwrite(nn->inputBiases, sizeof(float), N_HIDDEN, fp);
-  fwrite(nn->outputWeights, sizeof(float), N_L1, fp);
+
+  if (DEEP_HEAD) {
+    fwrite(nn->l2Weights, sizeof(float), N_L2 * N_L1, fp);
+    fwrite(nn->l2Biases, sizeof(float), N_L2, fp);
+    fwrite(nn->l3Weights, sizeof(float), N_L3 * N_L2, fp);
+    fwrite(nn->l3Biases, sizeof(float), N_L3, fp);
+    fwrite(nn->outputWeights, sizeof(float), N_L3, fp);
+  } else {
+    fwrite(nn->outputWeights, sizeof(float), N_L1, fp);
+  }
+
   fwrite(&nn->outputBias, sizeof(float), N_OUTPUT, fp);
 
   fclose(fp);
-}
\ No newline at end of file
+}
+
+// Rounds onto the engine's fixed point grid. The master weight is clamped to what the grid can hold,
+// so it cannot drift somewhere the quantized net never follows.
+static inline float FakeQuantize(float* w, const float scale) {
+  *w = fminf(32767.0f / scale, fmaxf(-32768.0f / scale, *w));
+  return roundf(*w * scale) / scale;
+}
+
+typedef struct {
+  NN* quantized;
+  NN* nn;
+  uint8_t* active;
+} QuantizeCtx;
+
+static void QuantizeRowsTask(int start, int end, int thread, void* arg) {
+  (void)thread;
+  QuantizeCtx* ctx = arg;
+
+  for (int r = start; r < end; r++) {
+    if (ctx->active && !ctx->active[r]) continue;
+
+    float* weights = &ctx->nn->inputWeights[r * N_HIDDEN];
+    float* quantized = &ctx->quantized->inputWeights[r * N_HIDDEN];
+    for (int j = 0; j < N_HIDDEN; j++) quantized[j] = FakeQuantize(&weights[j], QUANT_IN);
+  }
+}
+
+// Refreshes the fake-quantized copy of nn, only the input rows marked active (all of them without)
+void QuantizeNN(NN* quantized, NN* nn, uint8_t* active) {
+  QuantizeCtx ctx = {.quantized = quantized, .nn = nn, .active = active};
+  ParallelFor(N_INPUT, 8, QuantizeRowsTask, &ctx);
+
+  for (int i = 0; i < N_HIDDEN; i++) quantized->inputBiases[i] = FakeQuantize(&nn->inputBiases[i], QUANT_IN);
+  for (int i = 0; i < N_L1; i++) quantized->outputWeights[i] = FakeQuantize(&nn->outputWeights[i], QUANT_OUT);
+
+  quantized->outputBias = roundf(nn->outputBias * QUANT_IN * QUANT_OUT) / (QUANT_IN * QUANT_OUT);
+}
@@ -2,15 +2,26 @@
 #define NN_H
 
 #include <immintrin.h>
+#include <string.h>
 
 #include "types.h"
 #include "util.h"
 
 void NNPredict(NN* nn, Features* f, Color stm, NetworkTrace* trace);
+void NNAccumulate(NN* nn, Features* f, Color stm, float* accumulator);
+void NNAccumulateIndices(NN* nn, Feature (*features)[2], int n, Color stm, float* accumulator);
+
+void SetHidden(int hidden);
 
 NN* LoadNN(char* path);
+void ReadNN(NN* nn, char* path);
 NN* LoadRandomNN();
+void RandomizeNN(NN* nn);
 void SaveNN(NN* nn, char* path);
+void QuantizeNN(NN* quantized, NN* nn, uint8_t* active);
+void HeadForward(NN* nn, float* accumulators, const int n, HeadTrace* head, float* raw);
+void HeadBackward(NN* nn, float* accumulators, const int n, HeadTrace* head, float* outputLosses,
+                  BatchGradients* local, float* inputLosses);
 
 INLINE void ReLU(float* v, const size_t n) {
   const size_t width = sizeof(__m256) / sizeof(float);
@@ -21,6 +32,8 @@ INLINE void ReLU(float* v, const size_t n) {
   __m256* vector = (__m256*)v;
 
   for (size_t j = 0; j < chunks; j++) vector[j] = _mm256_max_ps(zero, vector[j]);
+
+  for (size_t j = chunks * width; j < n; j++) v[j] = fmaxf(0.0f, v[j]);
 }
 
 INLINE void CReLU(float* v, const size_t n) {
@@ -28,11 +41,21 @@ INLINE void CReLU(float* v, const size_t n) {
   const size_t chunks = n / width;
 
   const __m256 zero = _mm256_setzero_ps();
-  const __m256 max = _mm256_set1_ps(CRELU_MAX);
+  const __m256 max = _mm256_set1_ps(CRELU_CLIP);
 
   __m256* vector = (__m256*)v;
 
   for (size_t j = 0; j < chunks; j++) vector[j] = _mm256_min_ps(max, _mm256_max_ps(zero, vector[j]));
+
+  for (size_t j = chunks * width; j < n; j++) v[j] = fminf(CRELU_CLIP, fmaxf(0.0f, v[j]));
+}
+
+// The hidden activation, clipped to the engine's range when training quantization aware
+INLINE void Activate(float* v, const size_t n) {
+  if (QAT)
+    CReLU(v, n);
+  else
+    ReLU(v, n);
 }
 
 INLINE float DotProduct(float* v1, float* v2, const size_t n) {
@@ -45,16 +68,155 @@ INLINE float DotProduct(float* v1, float* v2, const size_t n) {
   __m256* vector1 = (__m256*)v1;
   __m256* vector2 = (__m256*)v2;
 
-  for (size_t j = 0; j < chunks; j += 2) {
+  size_t j = 0;
+  for (; j + 1 < chunks; j += 2) {
     s0 = _mm256_add_ps(_mm256_mul_ps(vector1[j], vector2[j]), s0);
     s1 = _mm256_add_ps(_mm256_mul_ps(vector1[j + 1], vector2[j + 1]), s1);
   }
 
+  if (j < chunks) s0 = _mm256_add_ps(_mm256_mul_ps(vector1[j], vector2[j]), s0);
+
   const __m256 r8 = _mm256_add_ps(s0, s1);
   const __m128 r4 = _mm_add_ps(_mm256_castps256_ps128(r8), _mm256_extractf128_ps(r8, 1));
   const __m128 r2 = _mm_add_ps(r4, _mm_movehl_ps(r4, r4));
   const __m128 r1 = _mm_add_ss(r2, _mm_shuffle_ps(r2, r2, 0x1));
-  return _mm_cvtss_f32(r1);
+
+  float tail = 0.0f;
+  for (j = chunks * width; j < n; j++) tail += v1[j] * v2[j];
+
+  return _mm_cvtss_f32(r1) + tail;
+}
+
+// out[k] = bias + rows[k] . v for a block of rows, each load of v is shared by 4 rows
+INLINE void BlockDotProduct(float* rows, const size_t nRows, float* v, const size_t n, float bias, float* out) {
+  const size_t width = sizeof(__m256) / sizeof(float);
+  const size_t chunks = n / width;
+
+  size_t k = 0;
+  for (; k + 4 <= nRows && chunks * width == n; k += 4) {
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps();
+    __m256 s3 = _mm256_setzero_ps();
+
+    __m256* vector = (__m256*)v;
+    __m256* r0 = (__m256*)&rows[(k + 0) * n];
+    __m256* r1 = (__m256*)&rows[(k + 1) * n];
+    __m256* r2 = (__m256*)&rows[(k + 2) * n];
+    __m256* r3 = (__m256*)&rows[(k + 3) * n];
+
+    for (size_t j = 0; j < chunks; j++) {
+      s0 = _mm256_add_ps(_mm256_mul_ps(r0[j], vector[j]), s0);
+      s1 = _mm256_add_ps(_mm256_mul_ps(r1[j], vector[j]), s1);
+      s2 = _mm256_add_ps(_mm256_mul_ps(r2[j], vector[j]), s2);
+      s3 = _mm256_add_ps(_mm256_mul_ps(r3[j], vector[j]), s3);
+    }
+
+    // reduce all four at once, leaving lane i with the sum of row k + i
+    const __m256 s01 = _mm256_hadd_ps(s0, s1);
+    const __m256 s23 = _mm256_hadd_ps(s2, s3);
+    const __m256 s0123 = _mm256_hadd_ps(s01, s23);
+    const __m128 r4 = _mm_add_ps(_mm256_castps256_ps128(s0123), _mm256_extractf128_ps(s0123, 1));
+
+    _mm_storeu_ps(&out[k], _mm_add_ps(r4, _mm_set1_ps(bias)));
+  }
+
+  for (; k < nRows; k++) out[k] = bias + DotProduct(&rows[k * n], v, n);
+}
+
+// v += sum_k rows[k] * scales[k], a single pass over v for the whole block
+INLINE void BlockAxpy(float* v, float* rows, const size_t nRows, float* scales, const size_t n) {
+  const size_t width = sizeof(__m256) / sizeof(float);
+  const size_t chunks = n / width;
+
+  __m256* vector = (__m256*)v;
+
+  for (size_t j = 0; j < chunks; j++) {
+    __m256 s = vector[j];
+
+    for (size_t k = 0; k < nRows; k++)
+      s = _mm256_add_ps(_mm256_mul_ps(((__m256*)&rows[k * n])[j], _mm256_set1_ps(scales[k])), s);
+
+    vector[j] = s;
+  }
+
+  for (size_t j = chunks * width; j < n; j++)
+    for (size_t k = 0; k < nRows; k++) v[j] += rows[k * n + j] * scales[k];
+}
+
+// Lane i holds the sum of the i-th vector
+INLINE __m128 Reduce4(__m256 s0, __m256 s1, __m256 s2, __m256 s3) {
+  const __m256 s01 = _mm256_hadd_ps(s0, s1);
+  const __m256 s23 = _mm256_hadd_ps(s2, s3);
+  const __m256 s0123 = _mm256_hadd_ps(s01, s23);
+
+  return _mm_add_ps(_mm256_castps256_ps128(s0123), _mm256_extractf128_ps(s0123, 1));
+}
+
+// out[k][o] = biases[o] + weights[o] . in[k] for n rows of in, a small dense layer over a block of
+// positions. Tiles of 2 rows by 4 outputs keep their 8 sums in registers, with every input load used
+// 4 times and every weight load twice.
+INLINE void DenseForward(float* in, const size_t nIn, const size_t n, float* weights, float* biases,
+                         const size_t nOut, float* out) {
+  const size_t width = sizeof(__m256) / sizeof(float);
+  const size_t chunks = nIn / width;
+
+  size_t k = 0;
+  for (; k + 2 <= n && chunks * width == nIn && !(nOut % 4); k += 2) {
+    __m256* x0 = (__m256*)&in[(k + 0) * nIn];
+    __m256* x1 = (__m256*)&in[(k + 1) * nIn];
+
+    for (size_t o = 0; o < nOut; o += 4) {
+      __m256 s00 = _mm256_setzero_ps(), s01 = _mm256_setzero_ps(), s02 = _mm256_setzero_ps(),
+             s03 = _mm256_setzero_ps();
+      __m256 s10 = _mm256_setzero_ps(), s11 = _mm256_setzero_ps(), s12 = _mm256_setzero_ps(),
+             s13 = _mm256_setzero_ps();
+
+      __m256* w0 = (__m256*)&weights[(o + 0) * nIn];
+      __m256* w1 = (__m256*)&weights[(o + 1) * nIn];
+      __m256* w2 = (__m256*)&weights[(o + 2) * nIn];
+      __m256* w3 = (__m256*)&weights[(o + 3) * nIn];
+
+      for (size_t j = 0; j < chunks; j++) {
+        s00 = _mm256_add_ps(_mm256_mul_ps(x0[j], w0[j]), s00);
+        s01 = _mm256_add_ps(_mm256_mul_ps(x0[j], w1[j]), s01);
+        s02 = _mm256_add_ps(_mm256_mul_ps(x0[j], w2[j]), s02);
+        s03 = _mm256_add_ps(_mm256_mul_ps(x0[j], w3[j]), s03);
+        s10 = _mm256_add_ps(_mm256_mul_ps(x1[j], w0[j]), s10);
+        s11 = _mm256_add_ps(_mm256_mul_ps(x1[j], w1[j]), s11);
+        s12 = _mm256_add_ps(_mm256_mul_ps(x1[j], w2[j]), s12);
+        s13 = _mm256_add_ps(_mm256_mul_ps(x1[j], w3[j]), s13);
+      }
+
+      const __m128 b = _mm_loadu_ps(&biases[o]);
+      _mm_storeu_ps(&out[(k + 0) * nOut + o], _mm_add_ps(Reduce4(s00, s01, s02, s03), b));
+      _mm_storeu_ps(&out[(k + 1) * nOut + o], _mm_add_ps(Reduce4(s10, s11, s12, s13), b));
+    }
+  }
+
+  for (; k < n; k++)
+    for (size_t o = 0; o < nOut; o++) out[k * nOut + o] = biases[o] + DotProduct(&in[k * nIn], &weights[o * nIn], nIn);
+}
+
+// Backward of DenseForward. Weight and bias gradients are added to gradWeights and gradBiases, and
+// the gradient of each input row is written to gradIn (n rows of nIn).
+INLINE void DenseBackward(float* in, const size_t nIn, const size_t n, float* gradOut, const size_t nOut,
+                          float* weights, float* gradWeights, float* gradBiases, float* gradIn) {
+  float scales[OUTPUT_BLOCK];
+
+  for (size_t o = 0; o < nOut; o++) {
+    for (size_t k = 0; k < n; k++) {
+      scales[k] = gradOut[k * nOut + o];
+      gradBiases[o] += scales[k];
+    }
+
+    BlockAxpy(&gradWeights[o * nIn], in, n, scales, nIn);
+  }
+
+  for (size_t k = 0; k < n; k++) {
+    memset(&gradIn[k * nIn], 0, sizeof(float) * nIn);
+    BlockAxpy(&gradIn[k * nIn], weights, nOut, &gradOut[k * nOut], nIn);
+  }
 }
 
-#endif
\ No newline at end of file
+#endif
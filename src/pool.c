@@ -0,0 +1,182 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "util.h"
+
+// How many times an idle worker yields, waiting on the next job before sleeping
+#define SPIN_COUNT 2048
+
+typedef struct {
+  TaskGroup* group;
+  int start, end;
+} Task;
+
+// Each thread owns a contiguous slice of the task list. The owner works forward
+// from the head while thieves take from the tail. Both ends are packed into one
+// word (head in the low half) so either side claims a task with a single CAS.
+typedef struct {
+  _Atomic uint64_t range;
+  double outOfWork;
+} ALIGN64 Deque;
+
+static int nThreads = 1, nWorkers = 1;
+static Deque* deques;
+
+static Task* tasks;
+static int tasksCapacity;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static atomic_int generation;
+static atomic_int remaining;
+
+static double idleTime, totalTime;
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int Pop(Deque* deque) {
+  uint64_t range = atomic_load(&deque->range);
+
+  while ((uint32_t)range < (range >> 32))
+    if (atomic_compare_exchange_weak(&deque->range, &range, range + 1)) return (uint32_t)range;
+
+  return -1;
+}
+
+static int StealFrom(Deque* deque) {
+  uint64_t range = atomic_load(&deque->range);
+
+  while ((uint32_t)range < (range >> 32))
+    if (atomic_compare_exchange_weak(&deque->range, &range, range - (1ULL << 32))) return (range >> 32) - 1;
+
+  return -1;
+}
+
+static int Steal(int thread) {
+  for (int i = 1; i < nThreads; i++) {
+    int task = StealFrom(&deques[(thread + i) % nThreads]);
+    if (task >= 0) return task;
+  }
+
+  return -1;
+}
+
+static void Work(int thread) {
+  int i;
+  while ((i = Pop(&deques[thread])) >= 0 || (i = Steal(thread)) >= 0) {
+    Task* task = &tasks[i];
+    task->group->fn(task->start, task->end, thread, task->group->ctx);
+  }
+
+  deques[thread].outOfWork = Now();
+}
+
+static void* Worker(void* arg) {
+  const int thread = (intptr_t)arg;
+  int seen = 0;
+
+  while (1) {
+    // spin briefly for the next job before going to sleep
+    for (int spins = 0; atomic_load(&generation) == seen; spins++) {
+      if (spins < SPIN_COUNT) {
+        sched_yield();
+        continue;
+      }
+
+      pthread_mutex_lock(&lock);
+      while (atomic_load(&generation) == seen) pthread_cond_wait(&wake, &lock);
+      pthread_mutex_unlock(&lock);
+    }
+
+    seen = atomic_load(&generation);
+
+    // sat out by PoolSetThreads, and not counted in remaining
+    if (thread >= nThreads) continue;
+
+    Work(thread);
+    atomic_fetch_sub(&remaining, 1);
+  }
+
+  return NULL;
+}
+
+void PoolInit(int threads) {
+  nThreads = nWorkers = threads;
+  deques = AlignedMalloc(sizeof(Deque) * nThreads);
+
+  for (int t = 0; t < nThreads; t++) atomic_init(&deques[t].range, 0);
+
+  // the calling thread acts as worker 0
+  for (int t = 1; t < nThreads; t++) {
+    pthread_t worker;
+    pthread_create(&worker, NULL, &Worker, (void*)(intptr_t)t);
+    pthread_detach(worker);
+  }
+}
+
+// Runs the following jobs on only the first threads of the pool, up to the count it was started with
+void PoolSetThreads(int threads) { nThreads = threads < nWorkers ? threads : nWorkers; }
+
+void PoolRun(TaskGroup* groups, int nGroups) {
+  double start = Now();
+
+  int nTasks = 0;
+  for (int g = 0; g < nGroups; g++) nTasks += (groups[g].n + groups[g].chunk - 1) / groups[g].chunk;
+
+  if (nTasks > tasksCapacity) {
+    tasksCapacity = nTasks;
+    tasks = realloc(tasks, sizeof(Task) * tasksCapacity);
+  }
+
+  nTasks = 0;
+  for (int g = 0; g < nGroups; g++) {
+    for (int i = 0; i < groups[g].n; i += groups[g].chunk) {
+      int end = i + groups[g].chunk < groups[g].n ? i + groups[g].chunk : groups[g].n;
+      tasks[nTasks++] = (Task){.group = &groups[g], .start = i, .end = end};
+    }
+  }
+
+  // hand out contiguous slices, as a static schedule would, and let stealing even them out
+  for (int t = 0; t < nThreads; t++) {
+    uint64_t head = (uint64_t)nTasks * t / nThreads;
+    uint64_t tail = (uint64_t)nTasks * (t + 1) / nThreads;
+    atomic_store(&deques[t].range, head | tail << 32);
+  }
+
+  atomic_store(&remaining, nThreads - 1);
+
+  pthread_mutex_lock(&lock);
+  atomic_fetch_add(&generation, 1);
+  pthread_cond_broadcast(&wake);
+  pthread_mutex_unlock(&lock);
+
+  Work(0);
+
+  while (atomic_load(&remaining)) sched_yield();
+
+  double end = Now();
+  for (int t = 0; t < nThreads; t++) idleTime += end - deques[t].outOfWork;
+  totalTime += nThreads * (end - start);
+}
+
+void ParallelFor(int n, int chunk, TaskFn fn, void* ctx) {
+  TaskGroup group[1] = {{.fn = fn, .ctx = ctx, .n = n, .chunk = chunk}};
+  PoolRun(group, 1);
+}
+
+// Share of thread time spent waiting on the other threads to finish a job
+double PoolIdleFraction() { return totalTime > 0 ? idleTime / totalTime : 0; }
+
+void PoolResetStats() { idleTime = totalTime = 0; }
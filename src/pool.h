@@ -0,0 +1,23 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "types.h"
+
+// A task covers [start, end) of its group, and is run by a single thread
+typedef void (*TaskFn)(int start, int end, int thread, void* ctx);
+
+typedef struct {
+  TaskFn fn;
+  void* ctx;
+  int n, chunk;
+} TaskGroup;
+
+void PoolInit(int threads);
+void PoolSetThreads(int threads);
+void PoolRun(TaskGroup* groups, int nGroups);
+void ParallelFor(int n, int chunk, TaskFn fn, void* ctx);
+
+double PoolIdleFraction();
+void PoolResetStats();
+
+#endif
@@ -0,0 +1,120 @@
+#include "rank.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "nn.h"
+#include "trainer.h"
+#include "util.h"
+
+typedef struct {
+  char path[256];
+  int hidden, deep;
+  double error;
+} RankedNet;
+
+static int CompareNames(const void* a, const void* b) { return strcmp(((RankedNet*)a)->path, ((RankedNet*)b)->path); }
+
+static int CompareErrors(const void* a, const void* b) {
+  double x = ((RankedNet*)a)->error, y = ((RankedNet*)b)->error;
+  return (x > y) - (x < y);
+}
+
+// Every .nnue file in dir, in name order
+static RankedNet* ListNets(char* dir, int* n) {
+  DIR* d = opendir(dir);
+  if (d == NULL) {
+    printf("Cannot open directory: %s!\n", dir);
+    exit(1);
+  }
+
+  int capacity = 64;
+  RankedNet* nets = malloc(sizeof(RankedNet) * capacity);
+  *n = 0;
+
+  struct dirent* entry;
+  while ((entry = readdir(d))) {
+    size_t len = strlen(entry->d_name);
+    if (len < 5 || strcmp(entry->d_name + len - 5, ".nnue")) continue;
+
+    if (*n == capacity) nets = realloc(nets, sizeof(RankedNet) * (capacity *= 2));
+    snprintf(nets[(*n)++].path, sizeof(nets->path), "%s/%s", dir, entry->d_name);
+  }
+
+  closedir(d);
+
+  qsort(nets, *n, sizeof(RankedNet), CompareNames);
+  return nets;
+}
+
+// Scores the nets loaded so far, all of the architecture they were read with
+static void Score(FeatureCache* cache, RankedNet* ranked, NN** nets, int n) {
+  double errors[RANK_NETS];
+  CacheErrors(cache, nets, n, errors);
+
+  for (int j = 0; j < n; j++) ranked[j].error = errors[j];
+}
+
+// Validation error of every net in dir, with the validation set featurized once and scored RANK_NETS
+// nets at a time. Nets of a different hidden size or head from the ones before them start a new pass,
+// so a run's checkpoints go through in as few passes as possible.
+void RankNets(char* dir, char* validationsPath, uint64_t validations) {
+  int nNets;
+  RankedNet* ranked = ListNets(dir, &nNets);
+
+  if (!nNets) {
+    printf("No nets found in %s!\n", dir);
+    exit(1);
+  }
+
+  FeatureCache* cache = OpenFeatureCache(validationsPath, validations);
+
+  NN* nets[RANK_NETS];
+  for (int j = 0; j < RANK_NETS; j++) nets[j] = AlignedMalloc(sizeof(NN));
+
+  long start = GetTimeMS();
+
+  int first = 0, n = 0;
+  for (int i = 0; i < nNets; i++) {
+    ReadNN(nets[n], ranked[i].path);
+    ranked[i].hidden = N_HIDDEN, ranked[i].deep = DEEP_HEAD;
+
+    if (n && (ranked[i].hidden != ranked[first].hidden || ranked[i].deep != ranked[first].deep)) {
+      SetHidden(ranked[first].hidden), DEEP_HEAD = ranked[first].deep;
+      Score(cache, &ranked[first], nets, n);
+      SetHidden(ranked[i].hidden), DEEP_HEAD = ranked[i].deep;
+
+      // the net just read leads the next pass
+      NN* next = nets[n];
+      nets[n] = nets[0], nets[0] = next;
+      first = i, n = 0;
+    }
+
+    if (++n == RANK_NETS) {
+      Score(cache, &ranked[first], nets, n);
+      first = i + 1, n = 0;
+    }
+  }
+
+  if (n) Score(cache, &ranked[first], nets, n);
+
+  long elapsed = GetTimeMS() - start;
+
+  qsort(ranked, nNets, sizeof(RankedNet), CompareErrors);
+
+  printf("Ranked %d nets on %" PRIu64 " positions in %.1fs\n", nNets, cache->n, elapsed / 1000.0);
+  printf("%5s  %-10s  %-11s  %s\n", "Rank", "Error", "Net", "Path");
+  for (int i = 0; i < nNets; i++) {
+    char arch[16];
+    sprintf(arch, "%dx%d%s", N_INPUT, ranked[i].hidden, ranked[i].deep ? "+H" : "");
+
+    printf("%5d  %1.8f  %-11s  %s\n", i + 1, ranked[i].error, arch, ranked[i].path);
+  }
+
+  for (int j = 0; j < RANK_NETS; j++) AlignedFree(nets[j]);
+  FreeFeatureCache(cache);
+  free(ranked);
+}
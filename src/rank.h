@@ -0,0 +1,8 @@
+#ifndef RANK_H
+#define RANK_H
+
+#include "types.h"
+
+void RankNets(char* dir, char* validationsPath, uint64_t validations);
+
+#endif
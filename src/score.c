@@ -0,0 +1,177 @@
+#include "score.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+#include "cache.h"
+#include "data.h"
+#include "nn.h"
+#include "pool.h"
+#include "trainer.h"
+#include "util.h"
+
+typedef struct {
+  NN* nn;
+  Board* boards;
+  float* raw;
+
+  FeatureCache* cache;
+  uint64_t offset;
+} ScoreCtx;
+
+static void ScoreTask(int start, int end, int thread, void* arg) {
+  (void)thread;
+  ScoreCtx* ctx = arg;
+
+  if (ctx->cache) {
+    FeatureCache* cache = ctx->cache;
+    float accumulator[MAX_L1] ALIGN64;
+    HeadTrace head[1];
+
+    for (int i = start; i < end; i++) {
+      const uint64_t p = ctx->offset + i;
+
+      NNAccumulateIndices(ctx->nn, &cache->features[cache->offsets[p]], cache->offsets[p + 1] - cache->offsets[p],
+                          cache->stm[p], accumulator);
+      HeadForward(ctx->nn, accumulator, 1, head, &ctx->raw[i]);
+    }
+
+    return;
+  }
+
+  for (int i = start; i < end; i++) {
+    NetworkTrace trace[1];
+    Features f[1];
+
+    ToFeatures(&ctx->boards[i], f);
+    NNPredict(ctx->nn, f, ctx->boards[i].stm, trace);
+
+    ctx->raw[i] = trace->output;
+  }
+}
+
+// Labelled lines are in the training format, anything else is treated as a plain FEN
+static int ReadTextEntry(char* line, Board* board) {
+  if (strchr(line, '[')) {
+    LoadDataEntry(line, board);
+    return 1;
+  }
+
+  board->stm = strstr(line, "w ") ? WHITE : BLACK;
+  ParseFen(line, board);
+
+  return 0;
+}
+
+// Only the labels are needed out of a cached block, the features are read in place
+static size_t CacheBlock(FeatureCache* cache, uint64_t offset, Board* boards, uint8_t* labelled, size_t n) {
+  size_t x = cache->n - offset < n ? cache->n - offset : n;
+
+  for (size_t i = 0; i < x; i++) {
+    boards[i].wdl = cache->wdl[offset + i];
+    boards[i].eval = cache->eval[offset + i];
+  }
+  memset(labelled, 1, x);
+
+  return x;
+}
+
+static size_t ReadBlock(FILE* fin, Board* boards, uint8_t* labelled, size_t n, int text) {
+  if (!text) {
+    size_t x = fread(boards, sizeof(Board), n, fin);
+    memset(labelled, 1, x);
+
+    return x;
+  }
+
+  char line[128];
+  size_t x = 0;
+
+  while (x < n && fgets(line, 128, fin)) {
+    if (line[0] == '\n' || line[0] == '\r') continue;
+
+    labelled[x] = ReadTextEntry(line, &boards[x]);
+    x++;
+  }
+
+  return x;
+}
+
+// Writes the net's evaluation of every position in order. Scores are from the side to move's
+// perspective, raw output followed by its sigmoid (and the position's loss, when requested).
+// A .csv output is written as text, anything else as packed floats. A binpack with an up to date
+// feature cache (<in>.fc) is scored straight from the cache.
+void ScorePositions(NN* nn, char* in, char* out, uint64_t n, int text, int withLoss) {
+  FILE* fin = fopen(in, text ? "r" : "rb");
+  if (fin == NULL) printf("Cannot open file: %s!\n", in), exit(1);
+
+  FeatureCache* cache = NULL;
+  if (!text) {
+    fseek(fin, 0, SEEK_END);
+    uint64_t total = ftell(fin) / sizeof(Board);
+    fseek(fin, 0, SEEK_SET);
+
+    if (n > total) n = total;
+    if ((cache = LoadFeatureCache(in, n))) printf("Scoring from the feature cache %s.fc\n", in);
+  }
+
+  const char* ext = strrchr(out, '.');
+  const int csv = ext && !strcmp(ext, ".csv");
+
+  FILE* fout = fopen(out, csv ? "w" : "wb");
+  if (fout == NULL) printf("Cannot open file: %s!\n", out), exit(1);
+
+  if (csv) fprintf(fout, withLoss ? "raw,sigmoid,loss\n" : "raw,sigmoid\n");
+
+  Board* boards = malloc(sizeof(Board) * SCORE_BLOCK);
+  uint8_t* labelled = malloc(sizeof(uint8_t) * SCORE_BLOCK);
+  float* raw = malloc(sizeof(float) * SCORE_BLOCK);
+
+  ScoreCtx ctx = {.nn = nn, .boards = boards, .raw = raw, .cache = cache};
+
+  long start = GetTimeMS();
+  uint64_t count = 0;
+
+  size_t x;
+  while (count < n) {
+    const size_t block = n - count < SCORE_BLOCK ? n - count : SCORE_BLOCK;
+    x = cache ? CacheBlock(cache, count, boards, labelled, block) : ReadBlock(fin, boards, labelled, block, text);
+    if (!x) break;
+
+    ctx.offset = count;
+    ParallelFor(x, 1024, ScoreTask, &ctx);
+
+    for (size_t i = 0; i < x; i++) {
+      float record[3] = {raw[i], Sigmoid(raw[i]), 0};
+
+      if (withLoss) {
+        if (!labelled[i])
+          printf("\nPosition #%" PRIu64 " has no result or eval to score a loss against!\n", count + i + 1), exit(1);
+
+        record[2] = Error(record[1], &boards[i]);
+      }
+
+      if (csv)
+        fprintf(fout, withLoss ? "%.4f,%.8f,%.8f\n" : "%.4f,%.8f\n", record[0], record[1], record[2]);
+      else
+        fwrite(record, sizeof(float), 2 + withLoss, fout);
+    }
+
+    count += x;
+
+    long now = GetTimeMS();
+    printf("\rScored positions: [%10" PRIu64 "], Speed: [%9.0f pos/s]", count, 1000.0 * count / (now - start + 1));
+  }
+
+  printf("\n");
+
+  free(boards);
+  free(labelled);
+  free(raw);
+  if (cache) FreeFeatureCache(cache);
+
+  fclose(fin);
+  fclose(fout);
+}
@@ -0,0 +1,10 @@
+#ifndef SCORE_H
+#define SCORE_H
+
+#include "types.h"
+
+#define SCORE_BLOCK (1 << 20)
+
+void ScorePositions(NN* nn, char* in, char* out, uint64_t n, int text, int withLoss);
+
+#endif
@@ -0,0 +1,96 @@
+#include "sparse.h"
+
+#include <string.h>
+
+#include "board.h"
+#include "nn.h"
+
+// features, when given, are the boards' already featurized inputs
+void GroupBoards(SparseGroup* group, Board* boards, Features* features, int n) {
+  group->n = n;
+
+  uint32_t* counts = group->offsets;
+  memset(counts, 0, sizeof(group->offsets));
+
+  for (int k = 0; k < n; k++) {
+    Features* f = &group->features[k];
+    if (features)
+      *f = features[k];
+    else
+      ToFeatures(&boards[k], f);
+
+    for (int i = 0; i < f->n; i++) {
+      counts[f->features[i][boards[k].stm] + 1]++;
+      counts[f->features[i][boards[k].stm ^ 1] + 1]++;
+    }
+  }
+
+  for (int r = 0; r < N_INPUT; r++) counts[r + 1] += counts[r];
+
+  // offsets[r] marks the start of row r, and is used as its write head
+  for (int k = 0; k < n; k++) {
+    Features* f = &group->features[k];
+
+    for (int i = 0; i < f->n; i++) {
+      group->targets[group->offsets[f->features[i][boards[k].stm]]++] = k << 1;
+      group->targets[group->offsets[f->features[i][boards[k].stm ^ 1]]++] = k << 1 | 1;
+    }
+  }
+
+  // every head moved to the start of the following row, shift them back
+  memmove(&group->offsets[1], &group->offsets[0], sizeof(uint32_t) * N_INPUT);
+  group->offsets[0] = 0;
+}
+
+// Each weight row is read once for the whole group and added to every accumulator using it
+INLINE void GroupForwardSized(SparseGroup* group, NN* nn, const int hidden) {
+  for (int k = 0; k < group->n; k++) {
+    memcpy(&group->accumulators[k * 2 * hidden], nn->inputBiases, sizeof(float) * hidden);
+    memcpy(&group->accumulators[k * 2 * hidden + hidden], nn->inputBiases, sizeof(float) * hidden);
+  }
+
+  for (int r = 0; r < N_INPUT; r++) {
+    const float* weights = &nn->inputWeights[r * hidden];
+
+    for (uint32_t i = group->offsets[r]; i < group->offsets[r + 1]; i++) {
+      const uint16_t target = group->targets[i];
+      float* accumulator = &group->accumulators[((target >> 1) * 2 + (target & 1)) * hidden];
+
+      for (int j = 0; j < hidden; j++) accumulator[j] += weights[j];
+    }
+  }
+
+  Activate(group->accumulators, group->n * 2 * hidden);
+}
+
+// With the hidden losses filled in, reduce each row's gradient once and add it to the row
+INLINE void GroupBackwardSized(SparseGroup* group, float* inputWeightGradients, uint8_t* active, const int hidden) {
+  float gradient[MAX_HIDDEN] ALIGN64;
+
+  for (int r = 0; r < N_INPUT; r++) {
+    if (group->offsets[r] == group->offsets[r + 1]) continue;
+
+    active[r] = 1;
+    memset(gradient, 0, sizeof(float) * hidden);
+
+    for (uint32_t i = group->offsets[r]; i < group->offsets[r + 1]; i++) {
+      const uint16_t target = group->targets[i];
+      const float* loss = &group->losses[((target >> 1) * 2 + (target & 1)) * hidden];
+
+      for (int j = 0; j < hidden; j++) gradient[j] += loss[j];
+    }
+
+    float* row = &inputWeightGradients[r * hidden];
+    for (int j = 0; j < hidden; j++) row[j] += gradient[j];
+  }
+}
+
+SIZED_KERNEL(GroupForward, (SparseGroup * group, NN* nn), (group, nn))
+SIZED_KERNEL(GroupBackward, (SparseGroup * group, float* inputWeightGradients, uint8_t* active),
+             (group, inputWeightGradients, active))
+
+void GroupForward(SparseGroup* group, NN* nn) { GroupForwardKernels[HIDDEN_KERNEL](group, nn); }
+
+void GroupBackward(SparseGroup* group, float* inputWeightGradients, uint8_t* active) {
+  GroupBackwardKernels[HIDDEN_KERNEL](group, inputWeightGradients, active);
+}
@@ -0,0 +1,27 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "types.h"
+
+// Positions whose input layer is run together, feature-major
+#define INPUT_GROUP 128
+
+// A group of positions, with every (position, perspective) that uses a weight row
+// gathered under that row by a counting sort
+typedef struct {
+  int n;
+  Features features[INPUT_GROUP];
+
+  uint32_t offsets[N_INPUT + 1];
+  uint16_t targets[INPUT_GROUP * 64];  // position << 1 | perspective (0 for stm)
+
+  // n rows of N_L1
+  float accumulators[INPUT_GROUP * MAX_L1] ALIGN64;
+  float losses[INPUT_GROUP * MAX_L1] ALIGN64;
+} SparseGroup;
+
+void GroupBoards(SparseGroup* group, Board* boards, Features* features, int n);
+void GroupForward(SparseGroup* group, NN* nn);
+void GroupBackward(SparseGroup* group, float* inputWeightGradients, uint8_t* active);
+
+#endif
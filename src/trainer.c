@@ -1,21 +1,89 @@
 #include "trainer.h"
 
+#include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 
+#include "arena.h"
 #include "bits.h"
 #include "board.h"
+#include "cache.h"
+#include "check.h"
 #include "data.h"
 #include "gradients.h"
+#include "index.h"
+#include "metrics.h"
 #include "nn.h"
+#include "pool.h"
 #include "random.h"
+#include "rank.h"
+#include "score.h"
+#include "sparse.h"
+#include "tune.h"
 #include "util.h"
 
 extern volatile int DATA_LOADED;
 extern volatile int COMPLETE;
+extern volatile float READ_BANDWIDTH;
+
+// Swaps a model's hyperparameters and Adam ages into the globals the kernels read
+static void SelectModel(Model* model) {
+  ALPHA = model->alpha;
+  WDL = model->wdl;
+  EVAL = model->eval;
+  LAMBDA = model->lambda;
+  LAST_SEEN = model->lastSeen;
+}
+
+// Splits the data buffers' share of a memory cap into two staging buffers, a batch and the reservoir, returning
+// the bytes they take. The reservoir is left smaller than a batch when the share cannot hold one.
+static size_t SizeReservoir(Reservoir* reservoir, size_t budget) {
+  const uint64_t total = budget / sizeof(Board);
+  reservoir->stagingSize = total / 8 < RESERVOIR_REFILL ? total / 8 : RESERVOIR_REFILL;
+
+  const size_t fixed = 2 * ArenaBytes(sizeof(Board) * reservoir->stagingSize) + ArenaBytes(sizeof(Board) * BATCH_SIZE);
+  reservoir->size = (budget > fixed ? (budget - fixed) & ~(size_t)(ARENA_ALIGN - 1) : 0) / sizeof(Board);
+
+  return fixed + ArenaBytes(sizeof(Board) * reservoir->size);
+}
+
+// A sweep file has one model per line, "name alpha wdl eval lambda", with # comments
+static int LoadSweep(char* path, Model* models) {
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL) {
+    printf("Cannot open file: %s!\n", path);
+    exit(1);
+  }
+
+  int n = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), fp)) {
+    Model model = {0};
+    if (line[0] == '#' || sscanf(line, "%63s %f %f %f %f", model.name, &model.alpha, &model.wdl, &model.eval,
+                                 &model.lambda) != 5)
+      continue;
+
+    if (n == MAX_MODELS) {
+      printf("Too many models in %s, a max of %d is supported!\n", path, MAX_MODELS);
+      exit(1);
+    }
+
+    models[n++] = model;
+  }
+  fclose(fp);
+
+  if (!n) {
+    printf("No models found in %s!\n", path);
+    exit(1);
+  }
+
+  models[0].lastSeen = LAST_SEEN;
+  return n;
+}
 
 int main(int argc, char** argv) {
   setbuf(stdin, NULL);
@@ -27,18 +95,48 @@ int main(int argc, char** argv) {
   uint64_t validations = 1000000;
 
   char baseNetworkPath[128] = {0};
-  char samplesPath[128] = {0};
+  int nSamples = 0;
+  char samplesPaths[MAX_SOURCES][128] = {{0}};
   char validationsPath[128] = {0};
   char runName[128] = {0};
 
+  int readers = 4;
+  uint8_t direct = 0, blockSampling = 0;
+
+  // positions the loader keeps, everything without -F
+  char filterSpec[128] = {0};
+  Filter filter = {.active = 0};
+  uint64_t memoryCap = 0;
+
   uint8_t writing = 0, shuffling = 0;
   char outputPath[128] = {0};
 
+  uint8_t text = 0, withLoss = 0;
+  char scoresPath[128] = {0};
+
+  char baselinePath[128] = {0};
+
+  char sweepPath[128] = {0};
+
+  char rankPath[128] = {0};
+
+  uint8_t autotune = 0;
+  int flagged = 0;
+
+  // with a tolerance, epochs validate on a sample, with a full validation every fullEvery epochs
+  float sampleTolerance = 0.0;
+  int fullEvery = 10;
+
   int c;
-  while ((c = getopt(argc, argv, "sc:v:z:w:d:n:r:")) != -1) {
+  while ((c = getopt(argc, argv, "sc:v:z:w:d:n:r:j:ot:p:xlk:bfm:M:qB:L:C:aHh:e:E:PR:F:")) != -1) {
     switch (c) {
       case 'd':
-        strcpy(samplesPath, optarg);
+        if (nSamples == MAX_SOURCES) {
+          printf("Too many data files, a max of %d is supported!\n", MAX_SOURCES);
+          return 1;
+        }
+
+        strcpy(samplesPaths[nSamples++], optarg);
         break;
       case 'c':
         entries = atoll(optarg);
@@ -62,200 +160,1068 @@ int main(int argc, char** argv) {
       case 'r':
         strcpy(runName, optarg);
         break;
+      case 'j':
+        readers = atoi(optarg);
+        break;
+      case 'o':
+        direct = 1;
+        break;
+      case 't':
+        THREADS = atoi(optarg);
+        flagged |= CONFIG_THREADS;
+        break;
+      case 'p':
+        strcpy(scoresPath, optarg);
+        break;
+      case 'x':
+        text = 1;
+        break;
+      case 'l':
+        withLoss = 1;
+        break;
+      case 'k':
+        strcpy(baselinePath, optarg);
+        break;
+      case 'b':
+        blockSampling = 1;
+        break;
+      case 'f':
+        INPUT_ENGINE = FEATURE_MAJOR;
+        break;
+      case 'm':
+        memoryCap = atoll(optarg) << 20;
+        break;
+      case 'M':
+        strcpy(sweepPath, optarg);
+        break;
+      case 'q':
+        QAT = 1;
+        break;
+      case 'H':
+        DEEP_HEAD = 1;
+        break;
+      case 'h':
+        SetHidden(atoi(optarg));
+        break;
+      case 'e':
+        sampleTolerance = atof(optarg);
+        break;
+      case 'E':
+        fullEvery = atoi(optarg);
+        break;
+      case 'P':
+        PIPELINE = 1;
+        break;
+      case 'R':
+        strcpy(rankPath, optarg);
+        break;
+      case 'F':
+        strcpy(filterSpec, optarg);
+        ParseFilter(filterSpec, &filter);
+        break;
+      case 'B':
+        BATCH_SIZE = atoi(optarg);
+        flagged |= CONFIG_BATCH_SIZE;
+        break;
+      case 'L':
+        BATCHES_PER_LOAD = atoi(optarg);
+        flagged |= CONFIG_BATCHES_PER_LOAD;
+        break;
+      case 'C':
+        TRAIN_CHUNK = atoi(optarg);
+        flagged |= CONFIG_TRAIN_CHUNK;
+        break;
+      case 'a':
+        autotune = 1;
+        break;
       case '?':
         return 1;
     }
   }
 
-  if (!samplesPath[0]) {
+  if (baselinePath[0]) {
+    if (THREADS < 1) {
+      printf("Invalid thread count: %d!\n", THREADS);
+      return 1;
+    }
+
+    PoolInit(THREADS);
+    return RunChecks(baselinePath);
+  }
+
+  if (rankPath[0]) {
+    if (THREADS < 1) {
+      printf("Invalid thread count: %d!\n", THREADS);
+      return 1;
+    }
+
+    PoolInit(THREADS);
+    RankNets(rankPath, validationsPath, validations);
+    exit(0);
+  }
+
+  if (!nSamples) {
     printf("No data file specified!\n");
     return 1;
   }
 
   if (shuffling && writing) {
-    ShuffleBinpack(entries, samplesPath, outputPath);
+    ShuffleBinpack(entries, samplesPaths[0], outputPath);
     exit(0);
   }
 
   if (writing) {
-    WriteToFile(outputPath, samplesPath, entries);
+    WriteToFile(outputPath, samplesPaths[0], entries);
     exit(0);
   }
 
-  NN* nn;
-  if (!baseNetworkPath[0]) {
-    printf("No net specified, generating a random net.\n");
-    nn = LoadRandomNN();
-  } else {
+  // an autotuned config only applies to training, flags override it
+  if (!autotune && !scoresPath[0]) LoadConfig(CONFIG_PATH, flagged);
+
+  if (THREADS < 1) {
+    printf("Invalid thread count: %d!\n", THREADS);
+    return 1;
+  }
+
+  if (fullEvery < 1) {
+    printf("Invalid full validation interval: %d!\n", fullEvery);
+    return 1;
+  }
+
+  if (BATCH_SIZE < 1 || BATCHES_PER_LOAD < 1 || TRAIN_CHUNK < 1) {
+    printf("Invalid batch size, load size or train chunk: %d, %d, %d!\n", BATCH_SIZE, BATCHES_PER_LOAD, TRAIN_CHUNK);
+    return 1;
+  }
+
+  // the dense head has no quantized form
+  if (QAT && DEEP_HEAD) {
+    printf("Quantization aware training is not supported with the deep head!\n");
+    return 1;
+  }
+
+  PoolInit(THREADS);
+
+  if (autotune) {
+    CyclicalLoadArgs* args = calloc(1, sizeof(CyclicalLoadArgs));
+    args->nSources = nSamples;
+    args->readers = readers;
+    args->blockSampling = blockSampling;
+    args->filter = filter;
+
+    for (int i = 0; i < nSamples; i++) {
+      OpenDataSource(&args->sources[i], samplesPaths[i], entries, direct);
+      if (blockSampling) OpenIndex(&args->sources[i]);
+    }
+
+    Autotune(args, CONFIG_PATH);
+    exit(0);
+  }
+
+  if (scoresPath[0]) {
+    if (!baseNetworkPath[0]) {
+      printf("A net must be specified to score positions!\n");
+      return 1;
+    }
+
     printf("Loading net from %s\n", baseNetworkPath);
-    nn = LoadNN(baseNetworkPath);
+    NN* nn = LoadNN(baseNetworkPath);
+
+    ScorePositions(nn, samplesPaths[0], scoresPath, entries, text, withLoss);
+    exit(0);
   }
 
-  DataSet* validation = malloc(sizeof(DataSet));
-  validation->entries = NULL;
-  validation->n = 0;
+  // Without a sweep there is a single model, trained with the default hyperparameters
+  Model models[MAX_MODELS] = {{.alpha = ALPHA, .wdl = WDL, .eval = EVAL, .lambda = LAMBDA, .lastSeen = LAST_SEEN}};
+  int nModels = sweepPath[0] ? LoadSweep(sweepPath, models) : 1;
+
+  // each model of a sweep saves into a directory of its own, laid out like the run's without one
+  char runDir[192];
+  sprintf(runDir, "experiments/%s", runName);
+  if (sweepPath[0]) MakeDirectory(runDir);
 
-  LoadEntriesBinary(validationsPath, validation, validations, 0);
+  for (int m = 0; m < nModels; m++) {
+    if (!sweepPath[0]) {
+      strcpy(models[m].dir, runDir);
+      continue;
+    }
+
+    sprintf(models[m].dir, "%s/%s", runDir, models[m].name);
+    MakeDirectory(models[m].dir);
+    printf("Saving model %s to %s\n", models[m].name, models[m].dir);
+  }
+
+  // All of the large training buffers are placed up front in a single (huge page backed) arena, all but the
+  // data buffers are set by the nets being trained
+  const size_t netBytes = nModels * (1 + QAT + (sampleTolerance > 0)) * ArenaBytes(sizeof(NN)) +  //
+                          nModels * ArenaBytes(sizeof(NNGradients)) +                              //
+                          nModels * ArenaBytes(sizeof(int) * N_INPUT) +                            //
+                          (1 + PIPELINE) * ArenaBytes(sizeof(BatchGradients) * THREADS) +          //
+                          ArenaBytes(sizeof(Features) * BATCH_SIZE);
+
+  // With a memory cap the whole arena stays within it. The load buffers are replaced by two staging buffers,
+  // a single batch and a reservoir of whatever is left.
+  Reservoir* reservoir = NULL;
+  size_t dataBytes = 2 * ArenaBytes(sizeof(Board) * BATCHES_PER_LOAD * BATCH_SIZE);
+
+  if (memoryCap) {
+    reservoir = malloc(sizeof(Reservoir));
+    dataBytes = SizeReservoir(reservoir, memoryCap > netBytes ? memoryCap - netBytes : 0);
+
+    if (reservoir->size < (uint64_t)BATCH_SIZE) {
+      uint64_t least = (netBytes >> 20) + 1;
+      for (;; least++) {
+        SizeReservoir(reservoir, (least << 20) - netBytes);
+        if (reservoir->size >= (uint64_t)BATCH_SIZE) break;
+      }
+
+      printf("A memory cap of %" PRIu64 " MB is too small for the nets and a batch of %d, -m %" PRIu64
+             " is the least that fits!\n",
+             memoryCap >> 20, BATCH_SIZE, least);
+      return 1;
+    }
+  }
+
+  Arena arena[1];
+  ArenaInit(arena, netBytes + dataBytes);
+
+  for (int m = 0; m < nModels; m++) {
+    Model* model = &models[m];
+
+    model->nn = ArenaAlloc(arena, sizeof(NN));
+    if (!baseNetworkPath[0]) {
+      if (!m) printf("No net specified, generating a random net.\n");
+      RandomizeNN(model->nn);
+    } else {
+      if (!m) printf("Loading net from %s\n", baseNetworkPath);
+      ReadNN(model->nn, baseNetworkPath);
+    }
+
+    model->gradients = ArenaAlloc(arena, sizeof(NNGradients));
+    ClearGradients(model->gradients);
+
+    if (m) model->lastSeen = ArenaAlloc(arena, sizeof(int) * N_INPUT);
+
+    // quantization aware, the forward and backward passes see the net the engine will run
+    model->quantized = model->nn;
+    if (QAT) {
+      model->quantized = ArenaAlloc(arena, sizeof(NN));
+      QuantizeNN(model->quantized, model->nn, NULL);
+    }
+
+    model->previous = NULL;
+    if (sampleTolerance > 0) model->previous = ArenaAlloc(arena, sizeof(NN));
+  }
+
+  printf("Training a %d -> 2x%d net\n", N_INPUT, N_HIDDEN);
+  if (DEEP_HEAD) printf("Training with a %d -> %d -> %d -> 1 head\n", N_L1, N_L2, N_L3);
+
+  if (QAT)
+    printf("Training quantization aware, input x%d, output x%d, clipped at %d\n", QUANT_IN, QUANT_OUT, CRELU_MAX);
+
+  // featurized once per batch and shared by every model of a sweep
+  Features* features = ArenaAlloc(arena, sizeof(Features) * BATCH_SIZE);
+
+  BatchGradients* local = ArenaAlloc(arena, sizeof(BatchGradients) * THREADS);
+
+  // pipelined, each batch trains into one set of gradients while the step of the last consumes the other
+  BatchGradients* locals[2] = {local, local};
+  uint8_t actives[2][N_INPUT];
+  Pipeline pipeline[1] = {{.pending = 0}};
+  int steps = 0;
+
+  if (PIPELINE) {
+    locals[1] = ArenaAlloc(arena, sizeof(BatchGradients) * THREADS);
+    ClearLocal(locals[0]);
+    ClearLocal(locals[1]);
+
+    printf("Pipelining the optimizer step of each batch with the next batch, at most one step stale\n");
+  }
+
+  // validation positions are only ever featurized once, see <path>.fc
+  FeatureCache* validation = OpenFeatureCache(validationsPath, validations);
 
   DataSet* data = malloc(sizeof(DataSet));
-  data->entries = malloc(sizeof(Board) * BATCHES_PER_LOAD * BATCH_SIZE);
+  DataSet* nextData = NULL;
+
+  if (reservoir) {
+    data->entries = ArenaAlloc(arena, sizeof(Board) * BATCH_SIZE);
+    reservoir->entries = ArenaAlloc(arena, sizeof(Board) * reservoir->size);
+    reservoir->staging[0] = ArenaAlloc(arena, sizeof(Board) * reservoir->stagingSize);
+    reservoir->staging[1] = ArenaAlloc(arena, sizeof(Board) * reservoir->stagingSize);
+  } else {
+    data->entries = ArenaAlloc(arena, sizeof(Board) * BATCHES_PER_LOAD * BATCH_SIZE);
+
+    nextData = malloc(sizeof(DataSet));
+    nextData->entries = ArenaAlloc(arena, sizeof(Board) * BATCHES_PER_LOAD * BATCH_SIZE);
+    nextData->n = 0;
+  }
   data->n = 0;
 
-  DataSet* nextData = malloc(sizeof(DataSet));
-  nextData->entries = malloc(sizeof(Board) * BATCHES_PER_LOAD * BATCH_SIZE);
-  nextData->n = 0;
+  ArenaReport(arena);
 
-  NNGradients* gradients = malloc(sizeof(NNGradients));
-  ClearGradients(gradients);
+  for (int m = 0; m < nModels; m++) {
+    SelectModel(&models[m]);
+    models[m].error = CacheError(validation, models[m].quantized);
+    printf("Starting Error: [%1.8f]%s%s\n", models[m].error, nModels > 1 ? ", Model: " : "", models[m].name);
 
-  BatchGradients* local = malloc(sizeof(BatchGradients) * THREADS);
+    if (models[m].previous) memcpy(models[m].previous, models[m].quantized, sizeof(NN));
+  }
 
-  float error = TotalError(validation, nn);
-  printf("Starting Error: [%1.8f]\n", error);
+  if (sampleTolerance > 0)
+    printf("Validating on blocks of %d until the delta is within +-%g, all of it every %d epochs\n",
+           VALIDATION_BLOCK, sampleTolerance, fullEvery);
 
   CyclicalLoadArgs* args = malloc(sizeof(CyclicalLoadArgs));
-  args->entriesCount = entries;
-  args->fin = fopen(samplesPath, "rb");
+  args->nSources = nSamples;
+  args->readers = readers;
+  args->blockSampling = blockSampling;
   args->nextData = nextData;
+  args->reservoir = reservoir;
+  args->filter = filter;
+
+  if (filter.active) printf("Filtering loaded positions by %s\n", filterSpec);
+
+  for (int i = 0; i < nSamples; i++) {
+    DataSource* src = &args->sources[i];
+    OpenDataSource(src, samplesPaths[i], entries, direct);
+    if (blockSampling) OpenIndex(src);
+
+    printf("Streaming %" PRIu64 " positions from %s with weight %.3f\n", src->entriesCount, src->path, src->weight);
+  }
+
+  if (reservoir) {
+    printf("Filling a reservoir of %" PRIu64 " positions, refilled %" PRIu64 " at a time, within a cap of %" PRIu64
+           " MB\n",
+           reservoir->size, reservoir->stagingSize, memoryCap >> 20);
+    FillReservoir(args);
+  }
+
+  char metricsPath[256];
+  sprintf(metricsPath, "experiments/%s/metrics", runName);
+
+  Metrics* metrics = OpenMetrics(metricsPath);
+  Metrics live = {.error = models[0].error, .rss = ResidentBytes()};
+  long waited = 0, lastRss = GetTimeMS();
+  if (metrics) printf("Publishing live metrics to %s\n", metricsPath);
 
   pthread_t loadingThread;
-  pthread_create(&loadingThread, NULL, &CyclicalLoader, args);
+  pthread_create(&loadingThread, NULL, reservoir ? &ReservoirLoader : &CyclicalLoader, args);
   pthread_detach(loadingThread);
 
   int epoch = 0;
   while (++epoch <= 400) {
     long epochStart = GetTimeMS();
-    float te = 0.0;
 
-    while (!DATA_LOADED)
-      ;
+    if (!reservoir) {
+      long start = GetTimeMS();
+      while (!DATA_LOADED)
+        ;
+      waited += GetTimeMS() - start;
 
-    memcpy(data->entries, nextData->entries, sizeof(Board) * nextData->n);
-    DATA_LOADED = 0;
+      memcpy(data->entries, nextData->entries, sizeof(Board) * nextData->n);
+      DATA_LOADED = 0;
+    }
+
+    for (int m = 0; m < nModels; m++) models[m].trainError = 0.0;
 
     for (int b = 0; b < BATCHES_PER_LOAD; b++) {
-      uint8_t active[N_INPUT] = {0};
       ITERATION++;
 
-      float be = Train(b, data, nn, local, active);
-      te += be;
-      ApplyGradients(nn, gradients, local, active);
+      // a reservoir epoch is just BATCHES_PER_LOAD batches drawn into the one batch sized buffer
+      if (reservoir) DrawBatch(reservoir, data, BATCH_SIZE);
+
+      const int batch = reservoir ? 0 : b;
+      if (nModels > 1) FeaturizeBatch(&data->entries[batch * BATCH_SIZE], BATCH_SIZE, features);
+
+      float be = 0.0;
+      for (int m = 0; m < nModels; m++) {
+        SelectModel(&models[m]);
+
+        float me;
+
+        if (PIPELINE) {
+          // a sweep's pending step is the previous model's, so only a single model trains on stale weights
+          uint8_t* active = actives[steps & 1];
+          memset(active, 0, N_INPUT);
+
+          me = TrainPipelined(pipeline, batch, data, nModels > 1 ? features : NULL, models[m].quantized, models[m].nn,
+                              models[m].gradients, locals[steps++ & 1], active);
+        } else {
+          uint8_t active[N_INPUT] = {0};
+
+          me = Train(batch, data, nModels > 1 ? features : NULL, models[m].quantized, local, active);
+          ApplyGradients(models[m].nn, models[m].gradients, local, active);
+          if (QAT) QuantizeNN(models[m].quantized, models[m].nn, active);
+        }
+
+        models[m].trainError += me;
+        be += me / nModels;
+      }
 
       long now = GetTimeMS();
       printf("\rBatch: [#%d/%d], Error: [%1.8f], Speed: [%9.0f pos/s]", b + 1, BATCHES_PER_LOAD, be,
              1000.0 * (b + 1) * BATCH_SIZE / (now - epochStart));
-    }
 
-    char buffer[256];
-    sprintf(buffer, "experiments/%s/nn-epoch%d.nnue", runName, epoch);
-    SaveNN(nn, buffer);
+      if (metrics) {
+        // the resident set is read from /proc, so only about once a second
+        if (now - lastRss >= 1000) live.rss = ResidentBytes(), lastRss = now;
 
-    float newError = TotalError(validation, nn);
+        live.updated = now;
+        live.epoch = epoch;
+        live.batch = ITERATION;
+        live.queueDepth = reservoir ? reservoir->ready[reservoir->current ^ 1] : DATA_LOADED;
+        live.waited = waited + (reservoir ? reservoir->waited : 0);
+        live.loss = be;
+        live.speed = 1000.0 * (b + 1) * BATCH_SIZE / (now - epochStart > 0 ? now - epochStart : 1);
+        live.alpha = models[0].alpha;
+        PublishMetrics(metrics, &live);
+      }
+    }
+
+    // the last step of the epoch has nothing to run beside, and the saved nets must have it
+    FinishPending(pipeline);
 
     long now = GetTimeMS();
-    printf("\rEpoch: [#%5d], Error: [%1.8f], Delta: [%+1.8f], LR: [%.8f], Time: [%lds], Speed: [%9.0f pos/s]\n", epoch,
-           newError, error - newError, ALPHA, (now - epochStart) / 1000,
-           1000.0 * BATCHES_PER_LOAD * BATCH_SIZE / (now - epochStart));
+    float read = READ_BANDWIDTH, idle = 100.0 * PoolIdleFraction();
+
+    for (int m = 0; m < nModels; m++) {
+      Model* model = &models[m];
+      SelectModel(model);
 
+      char buffer[320];
+      sprintf(buffer, "%s/nn-epoch%d.nnue", model->dir, epoch);
+      SaveNN(model->nn, buffer);
 
-    sprintf(buffer, "experiments/%s/loss.csv", runName);
-    FILE* flog = fopen(buffer, "a");
-    if (flog) {
-      fprintf(flog, "\"%d\",\"%.8f\",\"%.8f\"\n", epoch, newError, te / BATCHES_PER_LOAD);
-      fclose(flog);
+      float newError, delta;
+      char sampled[32] = {0}, kept[32] = {0};
+
+      if (model->previous && epoch % fullEvery) {
+        uint64_t scored;
+        newError = SampledCacheError(validation, model->quantized, model->previous, sampleTolerance, &delta, &scored);
+        sprintf(sampled, ", Sampled: [%5.1f%%]", 100.0 * scored / validation->n);
+      } else {
+        newError = CacheError(validation, model->quantized);
+        delta = model->error - newError;
+      }
+
+      if (model->previous) memcpy(model->previous, model->quantized, sizeof(NN));
+
+      // of everything the loader has read so far
+      if (args->filter.active)
+        sprintf(kept, ", Kept: [%5.1f%%]", 100.0 * args->filter.kept / (args->filter.seen ? args->filter.seen : 1));
+
+      printf(
+          "\rEpoch: [#%5d], Error: [%1.8f], Delta: [%+1.8f], LR: [%.8f], Time: [%lds], Speed: [%9.0f pos/s], "
+          "Read: [%6.0f MB/s], Idle: [%4.1f%%]%s%s%s%s\n",
+          epoch, newError, delta, ALPHA, (now - epochStart) / 1000,
+          1000.0 * BATCHES_PER_LOAD * BATCH_SIZE / (now - epochStart), read, idle, sampled, kept,
+          nModels > 1 ? ", Model: " : "", model->name);
+
+      sprintf(buffer, "%s/loss.csv", model->dir);
+      FILE* flog = fopen(buffer, "a");
+      if (flog) {
+        fprintf(flog, "\"%d\",\"%.8f\",\"%.8f\"\n", epoch, newError, model->trainError / BATCHES_PER_LOAD);
+        fclose(flog);
+      }
+
+      model->error = newError;
+      if (epoch % STEP_RATE == 0) model->alpha *= GAMMA;
     }
 
-    error = newError;
-    if (epoch % STEP_RATE == 0)
-      ALPHA *= GAMMA;
+    live.error = models[0].error;
+    live.alpha = models[0].alpha;
+    PublishMetrics(metrics, &live);
+
+    PoolResetStats();
   }
 
   COMPLETE = 1;
 }
 
-float TotalError(DataSet* data, NN* nn) {
+// Per thread scratch of the feature-major engine
+static SparseGroup* groups = NULL;
+static int nGroupThreads = 0;
+
+static SparseGroup* Groups() {
+  if (nGroupThreads < THREADS) {
+    if (groups) AlignedFree(groups);
+
+    groups = AlignedMalloc(sizeof(SparseGroup) * THREADS);
+    nGroupThreads = THREADS;
+  }
+
+  return groups;
+}
+
+// Output layer and loss for a block of accumulators (n rows of N_L1) against its labels, returning the
+// block's total error
+static float LabelledBlock(NN* nn, float* wdl, float* eval, float* accumulators, const int n, HeadTrace* head,
+                           float* outputLosses) {
+  float raw[OUTPUT_BLOCK], errors[OUTPUT_BLOCK];
+
+  HeadForward(nn, accumulators, n, head, raw);
+  BlockLoss(raw, wdl, eval, errors, outputLosses, n);
+
+  float e = 0.0;
+  for (int k = 0; k < n; k++) e += errors[k];
+
+  return e;
+}
+
+static float OutputBlock(NN* nn, Board* boards, float* accumulators, const int n, HeadTrace* head,
+                         float* outputLosses) {
+  float wdl[OUTPUT_BLOCK], eval[OUTPUT_BLOCK];
+
+  for (int k = 0; k < n; k++) {
+    wdl[k] = boards[k].wdl / 2.0f;
+    eval[k] = boards[k].eval;
+  }
+
+  return LabelledBlock(nn, wdl, eval, accumulators, n, head, outputLosses);
+}
+
+typedef struct {
+  DataSet* data;
+  NN* nn;
+  float* errors;
+} ErrorCtx;
+
+static void TotalErrorTask(int start, int end, int t, void* arg) {
+  ErrorCtx* ctx = arg;
+  NN* nn = ctx->nn;
+
+  float accumulators[OUTPUT_BLOCK * MAX_L1] ALIGN64;
+  float outputLosses[OUTPUT_BLOCK];
+  HeadTrace head[1];
+
   float e = 0.0;
+  for (int b = start; b < end; b += OUTPUT_BLOCK) {
+    const int n = end - b < OUTPUT_BLOCK ? end - b : OUTPUT_BLOCK;
+    Board* boards = &ctx->data->entries[b];
 
-#pragma omp parallel for schedule(static) num_threads(THREADS) reduction(+ : e)
-  for (uint32_t i = 0; i < data->n; i++) {
-    Board* board = &data->entries[i];
+    for (int k = 0; k < n; k++) {
+      Features f[1];
 
-    NetworkTrace trace[1];
-    Features f[1];
+      ToFeatures(&boards[k], f);
+      NNAccumulate(nn, f, boards[k].stm, &accumulators[k * N_L1]);
+    }
+
+    e += OutputBlock(nn, boards, accumulators, n, head, outputLosses);
+  }
+
+  ctx->errors[t * ERROR_STRIDE] += e;
+}
 
-    ToFeatures(board, f);
-    NNPredict(nn, f, board->stm, trace);
+static void TotalErrorGroupTask(int start, int end, int t, void* arg) {
+  ErrorCtx* ctx = arg;
+  SparseGroup* group = &groups[t];
 
-    e += Error(Sigmoid(trace->output), board);
+  Board* boards = &ctx->data->entries[start];
+  float outputLosses[OUTPUT_BLOCK];
+  HeadTrace head[1];
+
+  GroupBoards(group, boards, NULL, end - start);
+  GroupForward(group, ctx->nn);
+
+  float e = 0.0;
+  for (int b = 0; b < group->n; b += OUTPUT_BLOCK) {
+    const int n = group->n - b < OUTPUT_BLOCK ? group->n - b : OUTPUT_BLOCK;
+    e += OutputBlock(ctx->nn, &boards[b], &group->accumulators[b * N_L1], n, head, outputLosses);
   }
 
+  ctx->errors[t * ERROR_STRIDE] += e;
+}
+
+float TotalError(DataSet* data, NN* nn) {
+  float errors[THREADS * ERROR_STRIDE];
+  memset(errors, 0, sizeof(errors));
+
+  ErrorCtx ctx = {.data = data, .nn = nn, .errors = errors};
+
+  if (INPUT_ENGINE == FEATURE_MAJOR) {
+    Groups();
+    ParallelFor(data->n, INPUT_GROUP, TotalErrorGroupTask, &ctx);
+  } else {
+    ParallelFor(data->n, 256, TotalErrorTask, &ctx);
+  }
+
+  float e = 0.0;
+  for (int t = 0; t < THREADS; t++) e += errors[t * ERROR_STRIDE];
+
   return e / data->n;
 }
 
-float Train(int batch, DataSet* data, NN* nn, BatchGradients* local, uint8_t* active) {
-#pragma omp parallel for schedule(static) num_threads(THREADS)
-  for (int t = 0; t < THREADS; t++) memset(&local[t], 0, sizeof(BatchGradients));
+typedef struct {
+  FeatureCache* cache;
+  NN* nn;
+  float* errors;
+} CacheErrorCtx;
+
+// Total error of cached positions start up to end
+static float CacheRangeError(FeatureCache* cache, NN* nn, uint64_t start, uint64_t end) {
+  float accumulators[OUTPUT_BLOCK * MAX_L1] ALIGN64;
+  float wdl[OUTPUT_BLOCK], eval[OUTPUT_BLOCK], outputLosses[OUTPUT_BLOCK];
+  HeadTrace head[1];
+
+  float e = 0.0;
+  for (uint64_t b = start; b < end; b += OUTPUT_BLOCK) {
+    const int n = end - b < OUTPUT_BLOCK ? end - b : OUTPUT_BLOCK;
+
+    for (int k = 0; k < n; k++) {
+      const uint64_t i = b + k;
+
+      NNAccumulateIndices(nn, &cache->features[cache->offsets[i]], cache->offsets[i + 1] - cache->offsets[i],
+                          cache->stm[i], &accumulators[k * N_L1]);
+
+      wdl[k] = cache->wdl[i] / 2.0f;
+      eval[k] = cache->eval[i];
+    }
+
+    e += LabelledBlock(nn, wdl, eval, accumulators, n, head, outputLosses);
+  }
+
+  return e;
+}
+
+static void CacheErrorTask(int start, int end, int t, void* arg) {
+  CacheErrorCtx* ctx = arg;
+  ctx->errors[t * ERROR_STRIDE] += CacheRangeError(ctx->cache, ctx->nn, start, end);
+}
+
+// TotalError over pre-featurized positions, a streaming pass over the cache's index arrays
+float CacheError(FeatureCache* cache, NN* nn) {
+  float errors[THREADS * ERROR_STRIDE];
+  memset(errors, 0, sizeof(errors));
+
+  CacheErrorCtx ctx = {.cache = cache, .nn = nn, .errors = errors};
+  ParallelFor(cache->n, 256, CacheErrorTask, &ctx);
 
-  uint8_t actives[THREADS][N_INPUT] = {0};
   float e = 0.0;
+  for (int t = 0; t < THREADS; t++) e += errors[t * ERROR_STRIDE];
+
+  return e / cache->n;
+}
 
-#pragma omp parallel for schedule(static) num_threads(THREADS) reduction(+ : e)
-  for (int n = 0; n < BATCH_SIZE; n++) {
-    const int t = omp_get_thread_num();
+typedef struct {
+  FeatureCache* cache;
+  NN** nets;
+  int n;
+  double* errors;
+} CacheErrorsCtx;
 
-    Board board = data->entries[n + batch * BATCH_SIZE];
+// CacheRangeError of several nets at once, each block's features and labels are read once and stay in
+// cache while every net gathers its rows for them
+static void CacheErrorsTask(int start, int end, int t, void* arg) {
+  CacheErrorsCtx* ctx = arg;
+  FeatureCache* cache = ctx->cache;
 
-    NetworkTrace trace[1];
-    Features f[1];
+  float accumulators[OUTPUT_BLOCK * MAX_L1] ALIGN64;
+  float wdl[OUTPUT_BLOCK], eval[OUTPUT_BLOCK], outputLosses[OUTPUT_BLOCK];
+  HeadTrace head[1];
 
-    ToFeatures(&board, f);
-    NNPredict(nn, f, board.stm, trace);
+  double e[RANK_NETS] = {0};
 
-    float out = Sigmoid(trace->output);
-    e += Error(out, &board);
+  for (int b = start; b < end; b += OUTPUT_BLOCK) {
+    const int n = end - b < OUTPUT_BLOCK ? end - b : OUTPUT_BLOCK;
+
+    for (int k = 0; k < n; k++) {
+      wdl[k] = cache->wdl[b + k] / 2.0f;
+      eval[k] = cache->eval[b + k];
+    }
+
+    for (int j = 0; j < ctx->n; j++) {
+      NN* nn = ctx->nets[j];
+
+      for (int k = 0; k < n; k++) {
+        const uint64_t i = b + k;
+        NNAccumulateIndices(nn, &cache->features[cache->offsets[i]], cache->offsets[i + 1] - cache->offsets[i],
+                            cache->stm[i], &accumulators[k * N_L1]);
+      }
 
-    // LOSS CALCULATIONS ------------------------------------------------------------------------
-    float outputLoss = SigmoidPrime(out) * ErrorGradient(out, &board);
+      e[j] += LabelledBlock(nn, wdl, eval, accumulators, n, head, outputLosses);
+    }
+  }
+
+  for (int j = 0; j < ctx->n; j++) ctx->errors[t * RANK_NETS + j] += e[j];
+}
+
+// CacheError of up to RANK_NETS nets of the current architecture in a single pass over the cache
+void CacheErrors(FeatureCache* cache, NN** nets, int n, double* errors) {
+  double totals[THREADS * RANK_NETS];
+  memset(totals, 0, sizeof(totals));
+
+  CacheErrorsCtx ctx = {.cache = cache, .nets = nets, .n = n, .errors = totals};
+  ParallelFor(cache->n, 256, CacheErrorsTask, &ctx);
+
+  for (int j = 0; j < n; j++) {
+    errors[j] = 0.0;
+    for (int t = 0; t < THREADS; t++) errors[j] += totals[t * RANK_NETS + j];
+
+    errors[j] /= cache->n;
+  }
+}
+
+typedef struct {
+  FeatureCache* cache;
+  NN* nn;
+  NN* previous;
+  uint32_t* blocks;
+  double* errors;
+  double* deltas;
+} SampleCtx;
+
+static void SampleTask(int start, int end, int t, void* arg) {
+  (void)t;
+  SampleCtx* ctx = arg;
+
+  for (int i = start; i < end; i++) {
+    const uint64_t first = (uint64_t)ctx->blocks[i] * VALIDATION_BLOCK;
+
+    ctx->errors[i] = CacheRangeError(ctx->cache, ctx->nn, first, first + VALIDATION_BLOCK) / VALIDATION_BLOCK;
+    ctx->deltas[i] = CacheRangeError(ctx->cache, ctx->previous, first, first + VALIDATION_BLOCK) / VALIDATION_BLOCK -
+                     ctx->errors[i];
+  }
+}
+
+// CacheError estimated from random blocks of the cache. Each block is scored by both nn and previous (the
+// last epoch's net), and blocks are added a round at a time until the 95% interval on the mean change is
+// narrower than +-tolerance. The paired change is far less noisy than the error itself. Returns the
+// estimated error, with the estimated change (previous - nn) in delta and the positions scored in scored.
+float SampledCacheError(FeatureCache* cache, NN* nn, NN* previous, float tolerance, float* delta, uint64_t* scored) {
+  // too few blocks to sample from, score them all
+  if (cache->n < (uint64_t)VALIDATION_MIN_BLOCKS * VALIDATION_BLOCK) {
+    float error = CacheError(cache, nn);
+    *delta = CacheError(cache, previous) - error;
+    *scored = cache->n;
+    return error;
+  }
+
+  static uint64_t seed = 0;
+  if (!seed) seed = GetTimeMS();
+
+  const uint32_t nBlocks = cache->n / VALIDATION_BLOCK;
+  uint32_t* blocks = malloc(sizeof(uint32_t) * nBlocks);
+  double* errors = malloc(sizeof(double) * nBlocks);
+  double* deltas = malloc(sizeof(double) * nBlocks);
+
+  // the positions after the last whole block are never sampled
+  for (uint32_t i = 0; i < nBlocks; i++) blocks[i] = i;
+  for (uint32_t i = nBlocks - 1; i > 0; i--) {
+    uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    uint32_t j = (z ^ (z >> 31)) % (i + 1), tmp = blocks[i];
+    blocks[i] = blocks[j], blocks[j] = tmp;
+  }
+
+  const uint32_t round = THREADS > VALIDATION_MIN_BLOCKS ? THREADS : VALIDATION_MIN_BLOCKS;
+
+  // running mean and variance of the change (Welford), and the sum of the errors
+  double mean = 0.0, m2 = 0.0, sum = 0.0;
+  uint32_t k = 0;
+
+  while (k < nBlocks) {
+    const uint32_t n = nBlocks - k < round ? nBlocks - k : round;
+
+    SampleCtx ctx = {.cache = cache,
+                     .nn = nn,
+                     .previous = previous,
+                     .blocks = &blocks[k],
+                     .errors = &errors[k],
+                     .deltas = &deltas[k]};
+    ParallelFor(n, 1, SampleTask, &ctx);
+
+    for (uint32_t i = k; i < k + n; i++) {
+      const double d = deltas[i] - mean;
+      mean += d / (i + 1);
+      m2 += d * (deltas[i] - mean);
+      sum += errors[i];
+    }
+    k += n;
 
-    float hiddenLosses[N_L1];
-    for (int i = 0; i < N_L1; i++)
-      hiddenLosses[i] = outputLoss * nn->outputWeights[i] * ReLUPrime(trace->accumulator[i]);
+    // sampled without replacement, so the interval closes to nothing as k reaches nBlocks
+    const double fpc = 1.0 - (double)k / nBlocks;
+    if (1.96 * sqrt(m2 / (k - 1) / k * fpc) < tolerance) break;
+  }
+
+  *delta = mean;
+  *scored = (uint64_t)k * VALIDATION_BLOCK;
+
+  free(blocks);
+  free(errors);
+  free(deltas);
+
+  return sum / k;
+}
+
+typedef struct {
+  int batch;
+  DataSet* data;
+  Features* features;
+  NN* nn;
+  BatchGradients* local;
+  uint8_t* actives;
+  float* errors;
+} TrainCtx;
+
+static void ClearLocalTask(int start, int end, int thread, void* arg) {
+  (void)thread;
+  TrainCtx* ctx = arg;
+
+  // only the part of each array the net's hidden size uses
+  for (int t = start; t < end; t++) {
+    BatchGradients* local = &ctx->local[t];
+
+    local->outputBias = 0;
+    memset(local->outputWeights, 0, sizeof(float) * N_L1);
+    memset(local->l3Biases, 0, sizeof(local->l3Biases));
+    memset(local->l3Weights, 0, sizeof(local->l3Weights));
+    memset(local->l2Biases, 0, sizeof(local->l2Biases));
+    memset(local->l2Weights, 0, sizeof(float) * N_L2 * N_L1);
+    memset(local->inputBiases, 0, sizeof(float) * N_HIDDEN);
+    memset(local->inputWeights, 0, sizeof(float) * N_INPUT * N_HIDDEN);
+  }
+}
+
+INLINE void TrainSized(int start, int end, int t, void* arg, const int hidden) {
+  TrainCtx* ctx = arg;
+
+  NN* nn = ctx->nn;
+  BatchGradients* local = ctx->local;
+  uint8_t* actives = &ctx->actives[t * N_INPUT];
+
+  float accumulators[OUTPUT_BLOCK * MAX_L1] ALIGN64;
+  float inputLosses[OUTPUT_BLOCK * MAX_L1] ALIGN64;
+  Features features[OUTPUT_BLOCK];
+  float outputLosses[OUTPUT_BLOCK];
+  HeadTrace head[1];
+
+  // straight through the clip, no gradient past either end of the quantized range
+  const float clip = QAT ? CRELU_CLIP : FLT_MAX;
+
+  float e = 0.0;
+  for (int b = start; b < end; b += OUTPUT_BLOCK) {
+    const int n = end - b < OUTPUT_BLOCK ? end - b : OUTPUT_BLOCK;
+    Board* boards = &ctx->data->entries[b + ctx->batch * BATCH_SIZE];
+    Features* blockFeatures = ctx->features ? &ctx->features[b] : features;
+
+    // INPUT LAYER ------------------------------------------------------------------------------
+    for (int k = 0; k < n; k++) {
+      if (!ctx->features) ToFeatures(&boards[k], &features[k]);
+      NNAccumulate(nn, &blockFeatures[k], boards[k].stm, &accumulators[k * 2 * hidden]);
+    }
     // ------------------------------------------------------------------------------------------
 
-    // OUTPUT LAYER GRADIENTS -------------------------------------------------------------------
-    local[t].outputBias += outputLoss;
-    for (int i = 0; i < N_L1; i++) local[t].outputWeights[i] += trace->accumulator[i] * outputLoss;
+    // OUTPUT LAYER AND LOSS, WHOLE BLOCK -------------------------------------------------------
+    e += OutputBlock(nn, boards, accumulators, n, head, outputLosses);
     // ------------------------------------------------------------------------------------------
 
-    // INPUT LAYER GRADIENTS --------------------------------------------------------------------
-    float lassos[N_L1];
-    for (int i = 0; i < N_L1; i++) lassos[i] = LAMBDA * (trace->accumulator[i] > 0);
+    // OUTPUT LAYER (AND HEAD) GRADIENTS --------------------------------------------------------
+    HeadBackward(nn, accumulators, n, head, outputLosses, &local[t], inputLosses);
+    // ------------------------------------------------------------------------------------------
 
-    float* stmLosses = hiddenLosses;
-    float* xstmLosses = &hiddenLosses[N_HIDDEN];
+    for (int k = 0; k < n; k++) {
+      float* accumulator = &accumulators[k * 2 * hidden];
+      Features* f = &blockFeatures[k];
+      const Color stm = boards[k].stm;
 
-    float* stmLassos = lassos;
-    float* xstmLassos = &lassos[N_HIDDEN];
+      // LOSS CALCULATIONS ----------------------------------------------------------------------
+      float hiddenLosses[MAX_L1];
+      for (int i = 0; i < 2 * hidden; i++)
+        hiddenLosses[i] = inputLosses[k * 2 * hidden + i] * ClippedReLUPrime(accumulator[i], clip);
+      // ----------------------------------------------------------------------------------------
 
-    for (int i = 0; i < N_HIDDEN; i++)
-      local[t].inputBiases[i] += stmLosses[i] + xstmLosses[i] + stmLassos[i] + xstmLassos[i];
+      // INPUT LAYER GRADIENTS ------------------------------------------------------------------
+      float lassos[MAX_L1];
+      for (int i = 0; i < 2 * hidden; i++) lassos[i] = LAMBDA * ClippedReLUPrime(accumulator[i], clip);
 
-    for (int i = 0; i < f->n; i++) {
-      int f1 = f->features[i][board.stm];
-      int f2 = f->features[i][board.stm ^ 1];
+      float* stmLosses = hiddenLosses;
+      float* xstmLosses = &hiddenLosses[hidden];
 
-      actives[t][f1] = actives[t][f2] = 1;
+      float* stmLassos = lassos;
+      float* xstmLassos = &lassos[hidden];
 
-      for (int j = 0; j < N_HIDDEN; j++) {
-        local[t].inputWeights[f1 * N_HIDDEN + j] += stmLosses[j] + stmLassos[j];
-        local[t].inputWeights[f2 * N_HIDDEN + j] += xstmLosses[j] + xstmLassos[j];
+      for (int i = 0; i < hidden; i++)
+        local[t].inputBiases[i] += stmLosses[i] + xstmLosses[i] + stmLassos[i] + xstmLassos[i];
+
+      for (int i = 0; i < f->n; i++) {
+        int f1 = f->features[i][stm];
+        int f2 = f->features[i][stm ^ 1];
+
+        actives[f1] = actives[f2] = 1;
+
+        for (int j = 0; j < hidden; j++) {
+          local[t].inputWeights[f1 * hidden + j] += stmLosses[j] + stmLassos[j];
+          local[t].inputWeights[f2 * hidden + j] += xstmLosses[j] + xstmLassos[j];
+        }
       }
+      // ----------------------------------------------------------------------------------------
     }
-    // ------------------------------------------------------------------------------------------
   }
 
-  for (int t = 0; t < THREADS; t++)
-    for (int i = 0; i < N_INPUT; i++) active[i] |= actives[t][i];
+  ctx->errors[t * ERROR_STRIDE] += e;
+}
+
+SIZED_KERNEL(Train, (int start, int end, int t, void* arg), (start, end, t, arg))
+
+// Feature-major, the whole task is a single group sharing every weight and gradient row
+static void TrainGroupTask(int start, int end, int t, void* arg) {
+  TrainCtx* ctx = arg;
+
+  NN* nn = ctx->nn;
+  BatchGradients* local = &ctx->local[t];
+  SparseGroup* group = &groups[t];
+
+  Board* boards = &ctx->data->entries[start + ctx->batch * BATCH_SIZE];
+  float outputLosses[OUTPUT_BLOCK];
+  HeadTrace head[1];
+
+  const float clip = QAT ? CRELU_CLIP : FLT_MAX;
+
+  // INPUT LAYER --------------------------------------------------------------------------------
+  GroupBoards(group, boards, ctx->features ? &ctx->features[start] : NULL, end - start);
+  GroupForward(group, nn);
+  // --------------------------------------------------------------------------------------------
+
+  float e = 0.0;
+  for (int b = 0; b < group->n; b += OUTPUT_BLOCK) {
+    const int n = group->n - b < OUTPUT_BLOCK ? group->n - b : OUTPUT_BLOCK;
+
+    // OUTPUT LAYER AND LOSS, WHOLE BLOCK -----------------------------------------------------
+    e += OutputBlock(nn, &boards[b], &group->accumulators[b * N_L1], n, head, outputLosses);
+    // ----------------------------------------------------------------------------------------
+
+    // OUTPUT LAYER (AND HEAD) GRADIENTS, ACCUMULATOR LOSSES STRAIGHT INTO THE GROUP -----------
+    HeadBackward(nn, &group->accumulators[b * N_L1], n, head, outputLosses, local, &group->losses[b * N_L1]);
+    // ----------------------------------------------------------------------------------------
+
+    // LOSS CALCULATIONS (WITH LASSO) ---------------------------------------------------------
+    for (int k = 0; k < n; k++) {
+      float* accumulator = &group->accumulators[(b + k) * N_L1];
+      float* losses = &group->losses[(b + k) * N_L1];
+
+      for (int i = 0; i < N_L1; i++)
+        losses[i] = (losses[i] + LAMBDA) * ClippedReLUPrime(accumulator[i], clip);
+
+      for (int i = 0; i < N_HIDDEN; i++) local->inputBiases[i] += losses[i] + losses[i + N_HIDDEN];
+    }
+    // ----------------------------------------------------------------------------------------
+  }
+
+  // INPUT LAYER GRADIENTS ----------------------------------------------------------------------
+  GroupBackward(group, local->inputWeights, &ctx->actives[t * N_INPUT]);
+  // --------------------------------------------------------------------------------------------
+
+  ctx->errors[t * ERROR_STRIDE] += e;
+}
+
+typedef struct {
+  Board* boards;
+  Features* features;
+} FeaturizeCtx;
+
+static void FeaturizeTask(int start, int end, int thread, void* arg) {
+  (void)thread;
+  FeaturizeCtx* ctx = arg;
+
+  for (int k = start; k < end; k++) ToFeatures(&ctx->boards[k], &ctx->features[k]);
+}
+
+void FeaturizeBatch(Board* boards, int n, Features* features) {
+  FeaturizeCtx ctx = {.boards = boards, .features = features};
+  ParallelFor(n, 256, FeaturizeTask, &ctx);
+}
+
+// features, when given, are the batch's inputs already featurized by FeaturizeBatch
+// Clears the gradients Train sums into, as far as the net's sizes reach
+void ClearLocal(BatchGradients* local) {
+  TrainCtx ctx = {.local = local};
+  ParallelFor(THREADS, 1, ClearLocalTask, &ctx);
+}
+
+// Trains on a batch while an optimizer step, if any, runs beside it in the same PoolRun. Train does not
+// clear local, see ClearLocal, so it must come in cleared, as a consuming step leaves it.
+float TrainOverlapped(int batch, DataSet* data, Features* features, NN* nn, BatchGradients* local, uint8_t* active,
+                      ApplyStep* step) {
+  uint8_t actives[THREADS * N_INPUT];
+  float errors[THREADS * ERROR_STRIDE];
+
+  memset(actives, 0, sizeof(actives));
+  memset(errors, 0, sizeof(errors));
+
+  TrainCtx ctx = {.batch = batch,
+                  .data = data,
+                  .features = features,
+                  .nn = nn,
+                  .local = local,
+                  .actives = actives,
+                  .errors = errors};
+
+  TaskGroup tasks[1 + APPLY_GROUPS];
+
+  if (INPUT_ENGINE == FEATURE_MAJOR) {
+    Groups();
+    tasks[0] = (TaskGroup){.fn = TrainGroupTask, .ctx = &ctx, .n = BATCH_SIZE, .chunk = INPUT_GROUP};
+  } else {
+    tasks[0] = (TaskGroup){.fn = TrainKernels[HIDDEN_KERNEL], .ctx = &ctx, .n = BATCH_SIZE, .chunk = TRAIN_CHUNK};
+  }
+
+  // the step's tasks go last, so the pool's static split hands them to the last threads and the rest
+  // steal their way through whichever phase is left
+  int nGroups = 1;
+  if (step) {
+    memcpy(&tasks[1], step->groups, sizeof(TaskGroup) * step->nGroups);
+    nGroups += step->nGroups;
+  }
+
+  PoolRun(tasks, nGroups);
+  if (step) FinishApply(step);
+
+  float e = 0.0;
+  for (int t = 0; t < THREADS; t++) {
+    e += errors[t * ERROR_STRIDE];
+
+    for (int i = 0; i < N_INPUT; i++) active[i] |= actives[t * N_INPUT + i];
+  }
 
   return e / BATCH_SIZE;
-}
\ No newline at end of file
+}
+
+float Train(int batch, DataSet* data, Features* features, NN* nn, BatchGradients* local, uint8_t* active) {
+  ClearLocal(local);
+
+  return TrainOverlapped(batch, data, features, nn, local, active, NULL);
+}
+
+// The pending step is over, refresh the quantized copy it was trained against
+static void EndPending(Pipeline* pipeline) {
+  if (QAT) QuantizeNN(pipeline->quantized, pipeline->step->ctx.nn, pipeline->step->ctx.active);
+
+  pipeline->pending = 0;
+}
+
+// One batch of the pipeline (-P). Trains forward on the batch beside the pending step, whose groups
+// TrainOverlapped runs and finishes, then leaves this batch's step of nn pending in its place.
+float TrainPipelined(Pipeline* pipeline, int batch, DataSet* data, Features* features, NN* forward, NN* nn,
+                     NNGradients* grads, BatchGradients* local, uint8_t* active) {
+  float error = TrainOverlapped(batch, data, features, forward, local, active,  //
+                                pipeline->pending ? pipeline->step : NULL);
+  if (pipeline->pending) EndPending(pipeline);
+
+  PrepareApply(pipeline->step, nn, grads, local, active, 1);
+  pipeline->quantized = forward;
+  pipeline->pending = 1;
+
+  return error;
+}
+
+// Runs the pending step on its own, when no batch is left to run it beside
+void FinishPending(Pipeline* pipeline) {
+  if (!pipeline->pending) return;
+
+  PoolRun(pipeline->step->groups, pipeline->step->nGroups);
+  FinishApply(pipeline->step);
+
+  EndPending(pipeline);
+}
@@ -1,11 +1,40 @@
 #ifndef TRAINER_H
 #define TRAINER_H
 
+#include "gradients.h"
 #include "types.h"
 #include "util.h"
 
+// per thread error sums are spaced a cache line apart
+#define ERROR_STRIDE (64 / sizeof(float))
+
+// Sampled validation scores random blocks of this many positions, at least VALIDATION_MIN_BLOCKS of them
+#define VALIDATION_BLOCK 4096
+#define VALIDATION_MIN_BLOCKS 16
+
+// The optimizer step the pipeline (-P) has yet to finish, run beside the next batch's Train. With QAT,
+// quantized is the copy the step's net is trained against.
+typedef struct {
+  ApplyStep step[1];
+  NN* quantized;
+  int pending;
+} Pipeline;
+
+// Nets scored together by a single pass of CacheErrors
+#define RANK_NETS 16
+
 float TotalError(DataSet* data, NN* nn);
-float Train(int batch, DataSet* data, NN* nn, BatchGradients* local, uint8_t* active);
+float CacheError(FeatureCache* cache, NN* nn);
+void CacheErrors(FeatureCache* cache, NN** nets, int n, double* errors);
+float SampledCacheError(FeatureCache* cache, NN* nn, NN* previous, float tolerance, float* delta, uint64_t* scored);
+void FeaturizeBatch(Board* boards, int n, Features* features);
+void ClearLocal(BatchGradients* local);
+float TrainOverlapped(int batch, DataSet* data, Features* features, NN* nn, BatchGradients* local, uint8_t* active,
+                      ApplyStep* step);
+float Train(int batch, DataSet* data, Features* features, NN* nn, BatchGradients* local, uint8_t* active);
+float TrainPipelined(Pipeline* pipeline, int batch, DataSet* data, Features* features, NN* forward, NN* nn,
+                     NNGradients* grads, BatchGradients* local, uint8_t* active);
+void FinishPending(Pipeline* pipeline);
 
 INLINE float Error(float r, Board* b) {
   return WDL * powf(fabs(r - b->wdl / 2.0), 2.5) +  //
@@ -17,4 +46,18 @@ INLINE float ErrorGradient(float r, Board* b) {
          EVAL * 2.5 * (r - b->eval) * sqrtf(fabs(r - b->eval));
 }
 
+// Sigmoid, loss and output gradient over a block of raw outputs, vectorized by the compiler
+// (x^2.5 as x * x * sqrt(x), expf through the vector math library)
+INLINE void BlockLoss(float* raw, float* wdl, float* eval, float* error, float* outputLoss, const int n) {
+  for (int k = 0; k < n; k++) {
+    const float out = 1.0f / (1.0f + expf(-raw[k] * SS));
+
+    const float w = out - wdl[k], e = out - eval[k];
+    const float rw = sqrtf(fabsf(w)), re = sqrtf(fabsf(e));
+
+    error[k] = (float)WDL * w * w * rw + (float)EVAL * e * e * re;
+    outputLoss[k] = out * (1.0f - out) * SS * 2.5f * ((float)WDL * w * rw + (float)EVAL * e * re);
+  }
+}
+
 #endif
\ No newline at end of file
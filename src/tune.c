@@ -0,0 +1,162 @@
+#include "tune.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "data.h"
+#include "gradients.h"
+#include "nn.h"
+#include "pool.h"
+#include "trainer.h"
+#include "util.h"
+
+static const int TUNE_BATCH_SIZES[] = {4096, 8192, 16384, 32768};
+static const int TUNE_CHUNKS[] = {32, 64, 128};
+
+#define N_TUNE_BATCH_SIZES (int)(sizeof(TUNE_BATCH_SIZES) / sizeof(int))
+#define N_TUNE_CHUNKS (int)(sizeof(TUNE_CHUNKS) / sizeof(int))
+
+// Settings from a previous autotune for a training run, missing or unknown keys and those set by a flag
+// leave the current value in place. Every value it changes is logged.
+void LoadConfig(char* path, int flagged) {
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL) return;
+
+  char line[128], key[64];
+  int value;
+
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "%63[^=]=%d", key, &value) != 2 || value < 1) continue;
+
+    int* setting = NULL;
+    if (!strcmp(key, "threads") && !(flagged & CONFIG_THREADS))
+      setting = &THREADS;
+    else if (!strcmp(key, "batch_size") && !(flagged & CONFIG_BATCH_SIZE))
+      setting = &BATCH_SIZE;
+    else if (!strcmp(key, "batches_per_load") && !(flagged & CONFIG_BATCHES_PER_LOAD))
+      setting = &BATCHES_PER_LOAD;
+    else if (!strcmp(key, "train_chunk") && !(flagged & CONFIG_TRAIN_CHUNK))
+      setting = &TRAIN_CHUNK;
+
+    if (setting == NULL || *setting == value) continue;
+
+    printf("Loaded %s from %s: [%d], was [%d]\n", key, path, value, *setting);
+    *setting = value;
+  }
+
+  fclose(fp);
+}
+
+void SaveConfig(char* path) {
+  FILE* fp = fopen(path, "w");
+  if (fp == NULL) {
+    printf("Unable to save config to %s!\n", path);
+    return;
+  }
+
+  fprintf(fp, "threads=%d\nbatch_size=%d\nbatches_per_load=%d\ntrain_chunk=%d\n", THREADS, BATCH_SIZE,
+          BATCHES_PER_LOAD, TRAIN_CHUNK);
+  fclose(fp);
+}
+
+// Trains TUNE_POSITIONS positions at the current settings, returning pos/s
+static double TuneRun(DataSet* sample, NN* nn, NNGradients* gradients, BatchGradients* local) {
+  const int batches = TUNE_POSITIONS / BATCH_SIZE;
+
+  long start = 0;
+  for (int b = -1; b < batches; b++) {
+    // the first batch warms up the caches and the pool, and is not timed
+    if (!b) start = GetTimeMS();
+
+    uint8_t active[N_INPUT] = {0};
+    ITERATION++;
+
+    Train(b < 0 ? 0 : b, sample, NULL, nn, local, active);
+    ApplyGradients(nn, gradients, local, active);
+  }
+
+  long elapsed = GetTimeMS() - start;
+  return 1000.0 * batches * BATCH_SIZE / (elapsed > 0 ? elapsed : 1);
+}
+
+// Times TUNE_LOADS loads of the sample as the training loader makes them, over the weighted sources with
+// every reader, sampling and filter of the run, returning pos/s. The first fills the sample and is not timed.
+static double TuneLoader(CyclicalLoadArgs* loader, DataSet* sample) {
+  int capacity = 64;
+  ReadRequest* requests = malloc(sizeof(ReadRequest) * capacity);
+
+  long start = 0;
+  for (int l = -1; l < TUNE_LOADS; l++) {
+    if (!l) start = GetTimeMS();
+
+    LoadDataSet(loader, sample, &requests, &capacity);
+  }
+
+  long elapsed = GetTimeMS() - start;
+  free(requests);
+
+  return 1000.0 * TUNE_LOADS * sample->n / (elapsed > 0 ? elapsed : 1);
+}
+
+// Times a short run of every combination of thread count (powers of two up to -t), batch size and
+// train chunk over sample data. The loader's own rate, reading and shuffling, caps what any of them
+// can reach. The best is saved to path, where later runs pick it up.
+void Autotune(CyclicalLoadArgs* loader, char* path) {
+  const int maxThreads = THREADS;
+
+  DataSet sample[1] = {{.n = TUNE_POSITIONS, .entries = malloc(sizeof(Board) * TUNE_POSITIONS)}};
+
+  const double loadRate = TuneLoader(loader, sample);
+  printf("Loader: [%9.0f pos/s]\n", loadRate);
+
+  NN* nn = AlignedMalloc(sizeof(NN));
+  RandomizeNN(nn);
+
+  NNGradients* gradients = AlignedMalloc(sizeof(NNGradients));
+  BatchGradients* local = AlignedMalloc(sizeof(BatchGradients) * maxThreads);
+
+  int bestThreads = THREADS, bestBatch = BATCH_SIZE, bestChunk = TRAIN_CHUNK;
+  double best = 0.0;
+
+  for (int t = 1;; t = t * 2 < maxThreads ? t * 2 : maxThreads) {
+    THREADS = t;
+    PoolSetThreads(t);
+
+    for (int b = 0; b < N_TUNE_BATCH_SIZES; b++) {
+      BATCH_SIZE = TUNE_BATCH_SIZES[b];
+
+      // the feature-major engine is chunked by its groups
+      for (int c = 0; c < (INPUT_ENGINE == FEATURE_MAJOR ? 1 : N_TUNE_CHUNKS); c++) {
+        TRAIN_CHUNK = TUNE_CHUNKS[c];
+
+        ClearGradients(gradients);
+        double rate = TuneRun(sample, nn, gradients, local);
+        double effective = rate < loadRate ? rate : loadRate;
+
+        printf("Threads: [%3d], Batch Size: [%6d], Train Chunk: [%4d], Speed: [%9.0f pos/s], "
+               "Effective: [%9.0f pos/s]\n",
+               THREADS, BATCH_SIZE, TRAIN_CHUNK, rate, effective);
+
+        if (effective > best) {
+          best = effective;
+          bestThreads = THREADS, bestBatch = BATCH_SIZE, bestChunk = TRAIN_CHUNK;
+        }
+      }
+    }
+
+    if (t == maxThreads) break;
+  }
+
+  THREADS = bestThreads, BATCH_SIZE = bestBatch, TRAIN_CHUNK = bestChunk;
+  PoolSetThreads(THREADS);
+
+  SaveConfig(path);
+  printf("Best: [%9.0f pos/s], Threads: [%d], Batch Size: [%d], Train Chunk: [%d], saved to %s\n", best, THREADS,
+         BATCH_SIZE, TRAIN_CHUNK, path);
+
+  AlignedFree(nn);
+  AlignedFree(gradients);
+  AlignedFree(local);
+  free(sample->entries);
+}
@@ -0,0 +1,22 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include "types.h"
+
+// Picked up by every run, and written by -a
+#define CONFIG_PATH "trainer.cfg"
+
+// Positions trained per autotune trial, enough for a couple of the largest batches
+#define TUNE_POSITIONS (1 << 17)
+
+// Timed loads of the sample, spread over the sources and past a cold first read
+#define TUNE_LOADS 4
+
+// Settings a flag has set, which the config leaves alone
+enum { CONFIG_THREADS = 1, CONFIG_BATCH_SIZE = 2, CONFIG_BATCHES_PER_LOAD = 4, CONFIG_TRAIN_CHUNK = 8 };
+
+void LoadConfig(char* path, int flagged);
+void SaveConfig(char* path);
+void Autotune(CyclicalLoadArgs* loader, char* path);
+
+#endif
@@ -1,9 +1,24 @@
 #include "types.h"
 
 int ITERATION = 0;
-int LAST_SEEN[N_INPUT] = {0};
+static int lastSeen[N_INPUT] = {0};
+int* LAST_SEEN = lastSeen;
 
+int BATCH_SIZE = 16384;
+int BATCHES_PER_LOAD = 6100;
+
+int THREADS = 16;
+int TRAIN_CHUNK = 64;
+int INPUT_ENGINE = POSITION_MAJOR;
+int QAT = 0;
+int DEEP_HEAD = 0;
+int PIPELINE = 0;  // the optimizer step of each batch runs beside the next batch's Train
+int N_HIDDEN = 512;
+int HIDDEN_KERNEL = 1;  // N_HIDDEN's place in HIDDEN_SIZES
 float ALPHA = 0.01f;
+float WDL = 0.5f;
+float EVAL = 0.5f;
+float LAMBDA = 1.0f / (1024 * 1024);
 
 const float SS = 3.68415f / 512;
 
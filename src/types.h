@@ -6,17 +6,34 @@
 #include <stdio.h>
 
 #define N_INPUT (12 * 2 * 64)
-#define N_HIDDEN 512
+// Hidden sizes the input layer kernels are compiled for, X(size, ...) for each. The net in use picks one
+// at runtime, and its weights are packed at its own stride into arrays sized for the largest.
+#define HIDDEN_SIZES(X, ...) X(256, __VA_ARGS__) X(512, __VA_ARGS__) X(768, __VA_ARGS__) X(1024, __VA_ARGS__)
+#define MAX_HIDDEN 1024
+#define MAX_L1 (2 * MAX_HIDDEN)
 #define N_L1 (2 * N_HIDDEN)
+// Dense head between the accumulator and the output, N_L1 -> N_L2 -> N_L3 -> N_OUTPUT with DEEP_HEAD
+#define N_L2 16
+#define N_L3 32
 #define N_OUTPUT 1
 
-#define THREADS 16
 
 // total fens in berserk9dev2.d9.bin - 2098790400
-#define BATCH_SIZE 16384
-#define BATCHES_PER_LOAD 6100
+extern int BATCH_SIZE;
+extern int BATCHES_PER_LOAD;
 
+extern int THREADS;
+extern int TRAIN_CHUNK;
+extern int INPUT_ENGINE;
+extern int QAT;
+extern int DEEP_HEAD;
+extern int PIPELINE;
+extern int N_HIDDEN;
+extern int HIDDEN_KERNEL;
 extern float ALPHA;
+extern float WDL;
+extern float EVAL;
+extern float LAMBDA;
 #define BETA1 0.95
 #define BETA2 0.999
 #define EPSILON 1e-8
@@ -24,12 +41,15 @@ extern float ALPHA;
 #define STEP_RATE 100
 #define GAMMA 0.1f
 
-#define WDL 0.5
-#define EVAL 0.5
-
-#define LAMBDA (1.0 / (1024 * 1024))
-
+// Quantization of the engine's int16 input layer and output layer, its accumulator is clipped at
+// CRELU_MAX in quantized units (CRELU_CLIP in float units)
+#define QUANT_IN 32
+#define QUANT_OUT 512
 #define CRELU_MAX 256
+#define CRELU_CLIP ((float)CRELU_MAX / QUANT_IN)
+
+// Positions pushed through the output layer and loss together
+#define OUTPUT_BLOCK 16
 
 #define ALIGN64 __attribute__((aligned(64)))
 
@@ -50,6 +70,8 @@ enum {
 
 enum { WHITE, BLACK };
 
+enum { POSITION_MAJOR, FEATURE_MAJOR };
+
 typedef uint8_t Color;
 typedef uint8_t Square;
 typedef uint8_t Piece;
@@ -73,48 +95,212 @@ typedef struct {
   Board* entries;
 } DataSet;
 
+#define CACHE_VERSION 1
+
+typedef struct {
+  uint32_t magic, version;
+  uint32_t nInput, featureSize;
+  uint64_t fileSize, n, nFeatures;
+} CacheHeader;
+
+// Positions featurized once, in CSR form. Position i's (white, black) feature pairs run from
+// features[offsets[i]] up to features[offsets[i + 1]], its labels are kept next to them.
+typedef struct {
+  uint64_t n, nFeatures;
+  uint64_t* offsets;
+  Feature (*features)[2];
+
+  uint8_t* stm;
+  uint8_t* wdl;
+  float* eval;
+} FeatureCache;
+
+#define MAX_SOURCES 16
+
+#define READ_CHUNK (4 << 20)
+#define DIRECT_ALIGN 4096
+
+// Sidecar index, blocks are sized so random block reads stay sequential I/O
+#define INDEX_BLOCK 65536
+#define INDEX_VERSION 1
+// Blocks mixed together by each in memory shuffle when sampling by block
+#define SHUFFLE_BLOCKS 16
+#define RESERVOIR_REFILL (1 << 20)
+// Positions the loader's filter decides on, and refills with, at a time
+#define FILTER_BLOCK 4096
+// Refills in a row the filter may keep nothing of before the loader gives up
+#define FILTER_RETRIES 256
+
+typedef struct {
+  uint32_t magic, version;
+  uint32_t recordSize;  // 0 for variable sized records
+  uint32_t blockSize;
+  uint64_t fileSize, nBlocks;
+} IndexHeader;
+
 typedef struct {
-  FILE* fin;
+  uint64_t offset;
+  uint32_t n, bytes;
+} IndexBlock;
+
+typedef struct {
+  char path[128];
+  int fd, directFd;
+  float weight;
   uint64_t entriesCount;
+  uint64_t location;
+
+  uint64_t nBlocks;
+  IndexBlock* blocks;
+} DataSource;
+
+typedef struct {
+  DataSource* src;
+  uint64_t offset, n;
+  Board* dest;
+} ReadRequest;
+
+// bounded memory mode, batches are drawn at random out of the reservoir and every drawn slot
+// is replaced with the next position of a staging buffer the loader refills from disk
+typedef struct {
+  uint64_t size;
+  Board* entries;
+
+  uint64_t stagingSize, cursor;
+  Board* staging[2];
+  volatile int ready[2];
+  int current;
 
+  uint64_t seed;
+  long waited;  // ms the trainer has spent waiting on a staging buffer
+} Reservoir;
+
+// Predicates on the positions the loader keeps, set with -F. Evals are compared in the sigmoid space
+// they are stored in, from the side to move. A disabled bound passes everything.
+typedef struct {
+  int active;
+  float minEval, maxEval;    // |eval| within a bound
+  int minPieces;             // popcount of the occupancies
+  int noCheck;               // the side to move is not in check
+  float winEval, lossEval;   // a win whose eval is below winEval, or a loss above lossEval, disagrees
+
+  uint64_t seen, kept;
+} Filter;
+
+typedef struct {
+  int nSources;
+  DataSource sources[MAX_SOURCES];
+
+  int readers;
+  int blockSampling;
   DataSet* nextData;
+  Reservoir* reservoir;
+  Filter filter;
 } CyclicalLoadArgs;
 
+typedef struct {
+  char* base;
+  size_t size, used;
+  size_t pageSize;
+  const char* kind;
+} Arena;
+
+#define METRICS_VERSION 1
+
+// Live telemetry of a run, mapped from experiments/<run>/metrics for any poller. The trainer is the only
+// writer and every field is a single 64 bit store. sequence is odd while an update is in flight, so a
+// reader retries until it sees the same even sequence on both sides of its copy.
+typedef struct {
+  uint32_t magic, version;
+  uint64_t sequence;
+
+  uint64_t updated;     // ms since the unix epoch
+  uint64_t epoch;
+  uint64_t batch;       // every batch of the run so far
+  uint64_t queueDepth;  // loads (or reservoir refills) waiting for the trainer
+  uint64_t waited;      // ms the trainer has spent waiting on the loader
+  uint64_t rss;         // bytes
+
+  double loss;   // of the last batch, averaged over the models of a sweep
+  double speed;  // pos/s over the epoch so far
+  double alpha;  // of the first model of a sweep
+  double error;  // the first model's validation error at the end of the last epoch
+} Metrics;
+
+// With DEEP_HEAD the output layer reads only the first N_L3 output weights, from the head's last layer
 typedef struct {
   float outputBias;
-  float outputWeights[N_L1] ALIGN64;
+  float outputWeights[MAX_L1] ALIGN64;
+
+  float l3Biases[N_L3] ALIGN64;
+  float l3Weights[N_L3 * N_L2] ALIGN64;
+  float l2Biases[N_L2] ALIGN64;
+  float l2Weights[N_L2 * MAX_L1] ALIGN64;
 
-  float inputBiases[N_HIDDEN] ALIGN64;
-  float inputWeights[N_INPUT * N_HIDDEN] ALIGN64;
+  float inputBiases[MAX_HIDDEN] ALIGN64;
+  float inputWeights[N_INPUT * MAX_HIDDEN] ALIGN64;
 } NN;
 
 typedef struct {
   float output;
-  float accumulator[N_L1] ALIGN64;
+  float accumulator[MAX_L1] ALIGN64;
 } ALIGN64 NetworkTrace;
 
+// Post ReLU activations of the dense head, for a block of positions
+typedef struct {
+  float l2[OUTPUT_BLOCK][N_L2] ALIGN64;
+  float l3[OUTPUT_BLOCK][N_L3] ALIGN64;
+} HeadTrace;
+
 typedef struct {
   float M, V;
 } Gradient;
 
 typedef struct {
   Gradient outputBias;
-  Gradient outputWeights[N_L1];
+  Gradient outputWeights[MAX_L1];
+
+  Gradient l3Biases[N_L3];
+  Gradient l3Weights[N_L3 * N_L2];
+  Gradient l2Biases[N_L2];
+  Gradient l2Weights[N_L2 * MAX_L1];
 
-  Gradient inputBiases[N_HIDDEN];
-  Gradient inputWeights[N_INPUT * N_HIDDEN];
+  Gradient inputBiases[MAX_HIDDEN];
+  Gradient inputWeights[N_INPUT * MAX_HIDDEN];
 } NNGradients;
 
 typedef struct {
   float outputBias;
-  float outputWeights[N_L1];
+  float outputWeights[MAX_L1] ALIGN64;
+
+  float l3Biases[N_L3] ALIGN64;
+  float l3Weights[N_L3 * N_L2] ALIGN64;
+  float l2Biases[N_L2] ALIGN64;
+  float l2Weights[N_L2 * MAX_L1] ALIGN64;
 
-  float inputBiases[N_HIDDEN];
-  float inputWeights[N_INPUT * N_HIDDEN];
+  float inputBiases[MAX_HIDDEN] ALIGN64;
+  float inputWeights[N_INPUT * MAX_HIDDEN] ALIGN64;
 } BatchGradients;
 
+#define MAX_MODELS 8
+
+// One network of a sweep, its hyperparameters and Adam ages are swapped into the globals while it trains
+typedef struct {
+  char name[64];
+  char dir[256];  // nets and loss.csv, experiments/<run>/<name> for a sweep
+  float alpha, wdl, eval, lambda;
+
+  NN* nn;
+  NN* quantized;  // the fake-quantized copy trained against with QAT, nn itself otherwise
+  NN* previous;   // the last epoch's (quantized) net, for the delta of sampled validation
+  NNGradients* gradients;
+  int* lastSeen;
+
+  float error, trainError;
+} Model;
+
 extern int ITERATION;
-extern int LAST_SEEN[N_INPUT];
+extern int* LAST_SEEN;
 extern const Piece OPPOSITE[12];
 extern const Feature KING_BUCKETS[64];
 extern const Square PSQT64_TO_32[64];
@@ -1,10 +1,14 @@
 #ifdef WIN32
+#include <direct.h>
 #include <windows.h>
 #else
 #include <stddef.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #endif
 
+#include <stdio.h>
+
 #include "util.h"
 
 #ifdef WIN32
@@ -18,8 +22,20 @@ long GetTimeMS() {
 }
 #endif
 
-void* AlignedMalloc(int size) {
+// Creates the directory if it does not exist yet, a failure shows up when something is written into it
+#ifdef WIN32
+void MakeDirectory(char* path) { _mkdir(path); }
+#else
+void MakeDirectory(char* path) { mkdir(path, 0755); }
+#endif
+
+void* AlignedMalloc(size_t size) {
   void* mem = malloc(size + 64 + sizeof(void*));
+  if (mem == NULL) {
+    printf("Unable to allocate %zu bytes!\n", size);
+    exit(1);
+  }
+
   void** ptr = (void**)((uintptr_t)(mem + 64 + sizeof(void*)) & ~(64 - 1));
   ptr[-1] = mem;
   return ptr;
@@ -9,7 +9,18 @@
 #define INLINE static inline __attribute__((always_inline))
 #define H(h, v) ((h) + (324723947ULL + (v))) ^ 93485734985ULL
 
+// name##Sized is an INLINE kernel whose last argument is the hidden size. SIZED_KERNEL compiles it once
+// for each of HIDDEN_SIZES with a constant trip count, into name##Kernels[HIDDEN_KERNEL] for the net in use.
+#define SIZED_ARGS(...) __VA_ARGS__
+#define SIZED_VARIANT(size, name, params, args) \
+  static void name##size params { name##Sized(SIZED_ARGS args, size); }
+#define SIZED_ENTRY(size, name, ...) name##size,
+#define SIZED_KERNEL(name, params, args)           \
+  HIDDEN_SIZES(SIZED_VARIANT, name, params, args) \
+  static void(*const name##Kernels[]) params = {HIDDEN_SIZES(SIZED_ENTRY, name)};
+
 long GetTimeMS();
+void MakeDirectory(char* path);
 
 INLINE float Sigmoid(float s) { return 1.0 / (1.0 + expf(-s * SS)); }
 
@@ -17,7 +28,10 @@ INLINE float SigmoidPrime(float s) { return s * (1.0 - s) * SS; }
 
 INLINE float ReLUPrime(float s) { return s > 0.0; }
 
-INLINE float CReLUPrime(float s) { return s > 0.0 && s < CRELU_MAX; }
+INLINE float CReLUPrime(float s) { return s > 0.0 && s < CRELU_CLIP; }
+
+// ReLUPrime or CReLUPrime, with the clip picked once outside of the loop
+INLINE float ClippedReLUPrime(float s, float clip) { return s > 0.0 && s < clip; }
 
 INLINE uint64_t NetworkHash(NN* nn) {
   uint64_t hash = 0;
@@ -33,7 +47,7 @@ INLINE uint64_t NetworkHash(NN* nn) {
   return hash;
 }
 
-void* AlignedMalloc(int size);
+void* AlignedMalloc(size_t size);
 void AlignedFree(void* ptr);
 
 #endif